@@ -0,0 +1,59 @@
+#include "analysis.h"
+#include "profile.h"
+
+// The kernels work on a block of rows x cols points of a larger 2D array, whose rows are stride points apart,
+// so that they apply both to a slab read from a file and to the local data block of the solver without its ghost zones.
+
+
+// Add the sum of each row of the block to rowSums, of each column to colSums and of all its points to total.
+void sumBlock(double *data, int stride, int rows, int cols, double *rowSums, double *colSums, double *total) {
+  // rows are shared between the threads, each one accumulating its own copy of colSums
+  PROFILE_START(PROFILE_ANALYSIS);
+  double sum = 0;
+  #pragma omp parallel for reduction(+:sum) reduction(+:colSums[:cols])
+  for(int y = 0; y < rows; y++) {
+    for(int x = 0; x < cols; x++) {
+      rowSums[y] += data[y*stride + x];
+      colSums[x] += data[y*stride + x];
+      sum += data[y*stride + x];
+    }
+  }
+  *total += sum;
+  PROFILE_STOP(PROFILE_ANALYSIS, (long long)rows * cols * sizeof(double));
+}
+
+
+// Store in diff, whose rows are diffStride points apart, the difference data - previous of the blocks.
+// diff may be data itself.
+void diffBlock(double *previous, double *data, int stride, int rows, int cols, double *diff, int diffStride) {
+  PROFILE_START(PROFILE_ANALYSIS);
+  #pragma omp parallel for
+  for(int y = 0; y < rows; y++) {
+    for(int x = 0; x < cols; x++) {
+      diff[y*diffStride + x] = data[y*stride + x] - previous[y*stride + x];
+    }
+  }
+  PROFILE_STOP(PROFILE_ANALYSIS, 2LL * rows * cols * sizeof(double));
+}
+
+
+// Store in coarse, whose rows are coarseStride points apart, the averages of the blocks of 2 x 2 points of the block, i.e.
+// (rows + 1) / 2 x (cols + 1) / 2 points. The last row and column of an odd block average the points that exist.
+void coarsenBlock(double *data, int stride, int rows, int cols, double *coarse, int coarseStride) {
+  PROFILE_START(PROFILE_ANALYSIS);
+  #pragma omp parallel for
+  for(int y = 0; y < (rows + 1) / 2; y++) {
+    int ny = 2 * y + 1 < rows ? 2 : 1;
+    for(int x = 0; x < (cols + 1) / 2; x++) {
+      int nx = 2 * x + 1 < cols ? 2 : 1;
+      double sum = 0;
+      for(int dy = 0; dy < ny; dy++) {
+        for(int dx = 0; dx < nx; dx++) {
+          sum += data[(2 * y + dy) * stride + 2 * x + dx];
+        }
+      }
+      coarse[y * coarseStride + x] = sum / (ny * nx);
+    }
+  }
+  PROFILE_STOP(PROFILE_ANALYSIS, (long long)rows * cols * sizeof(double));
+}
@@ -0,0 +1,10 @@
+#ifndef __ANALYSIS__
+#define __ANALYSIS__
+
+void sumBlock(double *data, int stride, int rows, int cols, double *rowSums, double *colSums, double *total);
+
+void diffBlock(double *previous, double *data, int stride, int rows, int cols, double *diff, int diffStride);
+
+void coarsenBlock(double *data, int stride, int rows, int cols, double *coarse, int coarseStride);
+
+#endif
@@ -0,0 +1,140 @@
+#include <mpi.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncWriter.h"
+
+// the writer thread and its bounded queue of staging buffers
+static struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+
+  double **buffers;
+  int *steps;
+  size_t frameSize;
+
+  // the queue holds count frames starting at the slot head
+  int depth;
+  int head;
+  int count;
+  int stop;
+
+  frameWriter write;
+  void *ctx;
+} writer;
+
+
+// body of the writer thread: write the queued frames in order until stopWriter is called
+static void *writerLoop(void *unused) {
+  (void)unused;
+
+  for(;;) {
+    pthread_mutex_lock(&writer.lock);
+    while(writer.count == 0 && !writer.stop) {
+      pthread_cond_wait(&writer.notEmpty, &writer.lock);
+    }
+    if(writer.count == 0) {
+      pthread_mutex_unlock(&writer.lock);
+      return NULL;
+    }
+    int slot = writer.head;
+    pthread_mutex_unlock(&writer.lock);
+
+    // the slot stays in the queue while it is written so that pushFrame does not reuse it
+    writer.write(writer.ctx, writer.buffers[slot], writer.steps[slot]);
+
+    pthread_mutex_lock(&writer.lock);
+    writer.head = (writer.head + 1) % writer.depth;
+    writer.count--;
+    pthread_cond_broadcast(&writer.notFull);
+    pthread_mutex_unlock(&writer.lock);
+  }
+}
+
+
+// start the writer thread with depth staging buffers of frameSize doubles.
+// write is called by the writer thread with ctx for each frame, in the order they were pushed.
+void startWriter(int depth, size_t frameSize, frameWriter write, void *ctx) {
+  writer.depth = depth;
+  writer.head = 0;
+  writer.count = 0;
+  writer.stop = 0;
+  writer.frameSize = frameSize;
+  writer.write = write;
+  writer.ctx = ctx;
+
+  writer.buffers = (double**)malloc(depth * sizeof(double*));
+  writer.steps = (int*)malloc(depth * sizeof(int));
+  for(int i = 0; i < depth; i++) {
+    writer.buffers[i] = (double*)malloc(frameSize * sizeof(double));
+    if(!writer.buffers[i]) {
+      fprintf(stderr, "Not enough memory for the staging buffers.\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+
+  pthread_mutex_init(&writer.lock, NULL);
+  pthread_cond_init(&writer.notEmpty, NULL);
+  pthread_cond_init(&writer.notFull, NULL);
+
+  if(pthread_create(&writer.thread, NULL, writerLoop, NULL)) {
+    fprintf(stderr, "Unable to start the writer thread.\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+
+// copy data in a staging buffer and queue it to be written as the frame step.
+// Wait for a free staging buffer if all of them are still queued.
+void pushFrame(double *data, int step) {
+  pthread_mutex_lock(&writer.lock);
+  while(writer.count == writer.depth) {
+    pthread_cond_wait(&writer.notFull, &writer.lock);
+  }
+  int slot = (writer.head + writer.count) % writer.depth;
+  pthread_mutex_unlock(&writer.lock);
+
+  memcpy(writer.buffers[slot], data, writer.frameSize * sizeof(double));
+  writer.steps[slot] = step;
+
+  pthread_mutex_lock(&writer.lock);
+  writer.count++;
+  pthread_cond_signal(&writer.notEmpty);
+  pthread_mutex_unlock(&writer.lock);
+}
+
+
+// wait until all the queued frames are written
+void flushWriter(void) {
+  pthread_mutex_lock(&writer.lock);
+  while(writer.count > 0) {
+    pthread_cond_wait(&writer.notFull, &writer.lock);
+  }
+  pthread_mutex_unlock(&writer.lock);
+}
+
+
+// write the remaining frames, then stop the writer thread and free the staging buffers
+void stopWriter(void) {
+  pthread_mutex_lock(&writer.lock);
+  writer.stop = 1;
+  pthread_cond_signal(&writer.notEmpty);
+  pthread_mutex_unlock(&writer.lock);
+
+  pthread_join(writer.thread, NULL);
+
+  pthread_mutex_destroy(&writer.lock);
+  pthread_cond_destroy(&writer.notEmpty);
+  pthread_cond_destroy(&writer.notFull);
+
+  for(int i = 0; i < writer.depth; i++) {
+    free(writer.buffers[i]);
+  }
+  free(writer.buffers);
+  free(writer.steps);
+}
@@ -0,0 +1,17 @@
+#ifndef __ASYNCWRITER__
+#define __ASYNCWRITER__
+
+#include <stddef.h>
+
+// function called by the writer thread to write a frame previously given to pushFrame
+typedef void (*frameWriter)(void *ctx, double *data, int step);
+
+void startWriter(int depth, size_t frameSize, frameWriter write, void *ctx);
+
+void pushFrame(double *data, int step);
+
+void flushWriter(void);
+
+void stopWriter(void);
+
+#endif
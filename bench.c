@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+
+#include <mpi.h>
+#include "stencil.h"
+#include "analysis.h"
+
+// Microbenchmarks of the kernels of stencil.c and analysis.c on a block in memory, without HDF5.
+// Print for each kernel a line label,kernel,height,width,threads,seconds,mpoints_per_s
+// where seconds is the best time of the repetitions and mpoints_per_s the number of points computed per second.
+// With --verify, check instead that stencilTiled and stencilTemporal give the same values as iter() for several tile
+// sizes, numbers of steps and boundaries, and fail on the first difference of each case.
+
+
+// Store in best the shortest time of reps executions of call.
+#define BEST_TIME(best, reps, call) do { \
+    best = 1e30; \
+    for(int r = 0; r < (reps); r++) { \
+      double t = MPI_Wtime(); \
+      call; \
+      t = MPI_Wtime() - t; \
+      if(t < best) best = t; \
+    } \
+  } while(0)
+
+
+static void report(const char *label, const char *kernel, int height, int width, double seconds, double points) {
+  printf("%s,%s,%d,%d,%d,%.6f,%.1f\n", label, kernel, height, width, omp_get_max_threads(), seconds, points / seconds / 1e6);
+}
+
+
+// One iteration of iter() in heat.c on a height x width block stored row by row, with the terms in the same order.
+static void reference(int height, int width, const double *cur, double *next) {
+  memcpy(next, cur, (size_t)height * width * sizeof(double));
+  for(int y = 1; y < height - 1; y++) {
+    for(int x = 1; x < width - 1; x++) {
+      size_t i = (size_t)y * width + x;
+      next[i] = (cur[i] * .5)
+        + (cur[i - 1] * .125)
+        + (cur[i + 1] * .125)
+        + (cur[i - width] * .125)
+        + (cur[i + width] * .125);
+    }
+  }
+}
+
+
+// Return 1 if the points [lo[0], hi[0][ x [lo[1], hi[1][ of a and b are identical, print the first difference otherwise.
+static int sameRect(const char *kernel, int width, const double *a, const double *b, int lo[2], int hi[2], int tile[2], int nsteps, int fixed[4]) {
+  for(int y = lo[0]; y < hi[0]; y++) {
+    for(int x = lo[1]; x < hi[1]; x++) {
+      size_t i = (size_t)y * width + x;
+      if(memcmp(a + i, b + i, sizeof(double))) {
+        fprintf(stderr, "%s differs from iter() at (%d, %d) with tiles of %dx%d, %d steps and fixed sides %d %d %d %d: %.17g instead of %.17g\n",
+            kernel, y, x, tile[0], tile[1], nsteps, fixed[0], fixed[1], fixed[2], fixed[3], b[i], a[i]);
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+
+// Compare stencilTiled and stencilTemporal with iter() on a height x width block, up to nsteps steps at once.
+// Return the number of cases that differ.
+static int verify(int height, int width, int nsteps) {
+  size_t size = (size_t)height * width;
+  double *cur  = (double*)malloc(size * sizeof(double));
+  double *next = (double*)malloc(size * sizeof(double));
+  double *ref[2] = { (double*)malloc(size * sizeof(double)), (double*)malloc(size * sizeof(double)) };
+  // values that are not multiples of the weights, so that a change of the order of the terms changes the rounding
+  for(size_t i = 0; i < size; i++) {
+    cur[i] = (double)((i * 7919) % 1013) / 7.;
+  }
+
+  // the default tiles, tiles of the width of a specialized row, and small tiles with partial tiles on the sides
+  int tiles[][2] = { {64, 512}, {16, 64}, {7, 13}, {1, 1} };
+  int nbTiles = sizeof(tiles) / sizeof(tiles[0]), failures = 0;
+
+  // one step on the whole block
+  reference(height, width, cur, ref[0]);
+  for(int t = 0; t < nbTiles; t++) {
+    setStencilTile(tiles[t][0], tiles[t][1]);
+    memcpy(next, cur, size * sizeof(double));
+    stencilTiled(width, cur, next, 1, height - 1, 1, width - 1);
+    int lo[2] = {0, 0}, hi[2] = {height, width}, fixed[4] = {1, 1, 1, 1};
+    failures += !sameRect("stencilTiled", width, ref[0], next, lo, hi, tiles[t], 1, fixed);
+  }
+
+  // nsteps at once, each side being either a boundary or ghost zones of nsteps points
+  memcpy(ref[0], cur, size * sizeof(double));
+  for(int s = 1; s <= nsteps; s++) {
+    reference(height, width, ref[(s - 1) % 2], ref[s % 2]);
+    for(int sides = 0; sides < 16; sides++) {
+      int fixed[4] = { sides & 1, (sides >> 1) & 1, (sides >> 2) & 1, (sides >> 3) & 1 };
+      int lo[2] = { fixed[0] ? 1 : s, fixed[2] ? 1 : s };
+      int hi[2] = { height - (fixed[1] ? 1 : s), width - (fixed[3] ? 1 : s) };
+      for(int t = 0; t < nbTiles; t++) {
+        setStencilTile(tiles[t][0], tiles[t][1]);
+        stencilTemporal(height, width, cur, next, lo, hi, fixed, s);
+        failures += !sameRect("stencilTemporal", width, ref[s % 2], next, lo, hi, tiles[t], s, fixed);
+      }
+    }
+  }
+
+  free(cur);
+  free(next);
+  free(ref[0]);
+  free(ref[1]);
+  return failures;
+}
+
+
+int main(int argc, char** argv) {
+  MPI_Init(&argc, &argv);
+
+  if(argc >= 4 && !strcmp(argv[1], "--verify")) {
+    int height = atoi(argv[2]), width = atoi(argv[3]);
+    int nsteps = argc > 4 ? atoi(argv[4]) : 4;
+    if(nsteps < 1 || height < 2 * nsteps + 1 || width < 2 * nsteps + 1) {
+      fprintf(stderr, "Invalid arguments.\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int failures = verify(height, width, nsteps);
+    if(!failures) {
+      printf("stencilTiled and stencilTemporal match iter() on a %dx%d block, up to %d steps\n", height, width, nsteps);
+    }
+    MPI_Finalize();
+    return failures ? 1 : 0;
+  }
+
+  if(argc < 4) {
+    fprintf(stderr, "Usage: %s <height> <width> <repetitions> [<nsteps>] [<label>]\n"
+                    "       %s --verify <height> <width> [<nsteps>]\n", argv[0], argv[0]);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  int height = atoi(argv[1]), width = atoi(argv[2]), reps = atoi(argv[3]);
+  int nsteps = argc > 4 ? atoi(argv[4]) : 4;
+  const char *label = argc > 5 ? argv[5] : "";
+  if(height < 3 || width < 3 || reps < 1 || nsteps < 1) {
+    fprintf(stderr, "Invalid arguments.\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  // a block with a boundary of one point, as a local data block of heat.out
+  size_t size = (size_t)height * width;
+  double *cur  = (double*)malloc(size * sizeof(double));
+  double *next = (double*)malloc(size * sizeof(double));
+  double *rows = (double*)calloc(height, sizeof(double));
+  double *cols = (double*)calloc(width, sizeof(double));
+  #pragma omp parallel for
+  for(int y = 0; y < height; y++) {
+    for(int x = 0; x < width; x++) {
+      cur[(size_t)y * width + x] = next[(size_t)y * width + x] = (y * 7 + x * 13) % 101;
+    }
+  }
+  double inner = (double)(height - 2) * (width - 2), best;
+
+  BEST_TIME(best, reps, stencilRect(width, cur, next, 1, height - 1, 1, width - 1));
+  report(label, "stencilRect", height, width, best, inner);
+
+  // the same stencil with weights chosen at runtime, without the specialized rows
+  setStencilWeights(.6, .1);
+  BEST_TIME(best, reps, stencilRect(width, cur, next, 1, height - 1, 1, width - 1));
+  report(label, "stencilRectWeights", height, width, best, inner);
+  setStencilWeights(.5, .125);
+
+  BEST_TIME(best, reps, stencilTiled(width, cur, next, 1, height - 1, 1, width - 1));
+  report(label, "stencilTiled", height, width, best, inner);
+
+  // the single precision kernel, on a copy of the block
+  float *fcur  = (float*)malloc(size * sizeof(float));
+  float *fnext = (float*)malloc(size * sizeof(float));
+  for(size_t i = 0; i < size; i++) {
+    fcur[i] = fnext[i] = cur[i];
+  }
+  BEST_TIME(best, reps, stencilTiledSingle(width, fcur, fnext, 1, height - 1, 1, width - 1));
+  report(label, "stencilTiledSingle", height, width, best, inner);
+  free(fcur);
+  free(fnext);
+
+  int lo[2] = {1, 1}, hi[2] = {height - 1, width - 1}, fixed[4] = {1, 1, 1, 1};
+  BEST_TIME(best, reps, stencilTemporal(height, width, cur, next, lo, hi, fixed, nsteps));
+  report(label, "stencilTemporal", height, width, best, inner * nsteps);
+
+  double total = 0;
+  BEST_TIME(best, reps, sumBlock(cur, width, height, width, rows, cols, &total));
+  report(label, "sumBlock", height, width, best, size);
+
+  BEST_TIME(best, reps, diffBlock(cur, next, width, height, width, next, width));
+  report(label, "diffBlock", height, width, best, size);
+
+  free(cur);
+  free(next);
+  free(rows);
+  free(cols);
+
+  MPI_Finalize();
+}
@@ -0,0 +1,101 @@
+#!/bin/sh
+# Benchmarks of heat.out and mean.out on a single node, and of the kernels without HDF5.
+# The results are appended to CSV files, one line per run, so that builds can be compared.
+#
+#   ./bench.sh strong    the problem size is fixed, the number of processes varies
+#   ./bench.sh weak      the number of points per process is fixed
+#   ./bench.sh kernels   bench.out on a single block, for several numbers of threads, after checking that
+#                        the tiled kernels give the same values as the reference kernel
+#
+# The parameters are read from the environment:
+#   BENCH_NP       numbers of processes (default "1 2 4"), oversubscribed if needed
+#   BENCH_SIZES    strong: height and width of the problem; weak: of the block of each process;
+#                  kernels: of the block (default "512 1024")
+#   BENCH_HALOS    widths of the ghost zones (default "1 4")
+#   BENCH_EVERY    iterations between two frames (default "10 100")
+#   BENCH_ITER     number of iterations (default 200)
+#   BENCH_OPTIONS  other options of heat.out (default "--kernel tiled")
+#   BENCH_THREADS  numbers of OpenMP threads of the kernels (default "1 2 4")
+#   BENCH_REPS     repetitions of the kernels, the best time is kept (default 10)
+#   BENCH_LABEL    label of the build in the results (default the git commit)
+#   BENCH_OUT      results of heat.out and mean.out (default bench.csv), the kernels go to bench_kernels.csv
+#   MPIRUN         (default "mpirun --oversubscribe")
+
+set -e
+
+mode=$1
+case "$mode" in
+  strong|weak|kernels) ;;
+  *) echo "Usage: $0 strong|weak|kernels" >&2; exit 1 ;;
+esac
+
+NP=${BENCH_NP:-"1 2 4"}
+SIZES=${BENCH_SIZES:-"512 1024"}
+HALOS=${BENCH_HALOS:-"1 4"}
+EVERY=${BENCH_EVERY:-"10 100"}
+ITER=${BENCH_ITER:-200}
+OPTIONS=${BENCH_OPTIONS:-"--kernel tiled"}
+THREADS=${BENCH_THREADS:-"1 2 4"}
+REPS=${BENCH_REPS:-10}
+LABEL=${BENCH_LABEL:-$(git rev-parse --short HEAD 2>/dev/null || echo unknown)}
+OUT=${BENCH_OUT:-bench.csv}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+here=$(pwd)
+
+if [ "$mode" = kernels ]; then
+  out=$(dirname "$OUT")/bench_kernels.csv
+  [ -s "$out" ] || echo "label,kernel,height,width,threads,seconds,mpoints_per_s" > "$out"
+  for size in $SIZES; do
+    # stops the benchmark if a kernel differs from iter()
+    ./bench.out --verify $size $size
+    for threads in $THREADS; do
+      OMP_NUM_THREADS=$threads ./bench.out $size $size $REPS 4 "$LABEL" | tee -a "$out"
+    done
+  done
+  exit 0
+fi
+
+# a field of the profile report: the maximum time ($4) or the bytes ($7) of a phase
+field() {
+  awk -F, -v phase=$2 -v col=$3 '$1 == phase { print $col }' $1
+}
+
+# the runs write their files in a directory of their own
+run=$(mktemp -d bench.run.XXXXXX)
+trap 'rm -rf "$run"' EXIT
+
+[ -s "$OUT" ] || echo "label,mode,np,height,width,halo,every,iter,seconds,steps_per_s,write_gb_s,mean_seconds,mean_gb_s" > "$OUT"
+for size in $SIZES; do
+  for np in $NP; do
+    height=$size; width=$size
+    if [ "$mode" = weak ]; then
+      # a grid of processes as square as possible, each with a size x size block
+      rows=1; d=1
+      while [ $((d * d)) -le $np ]; do
+        [ $((np % d)) -eq 0 ] && rows=$d
+        d=$((d + 1))
+      done
+      height=$((size * rows)); width=$((size * np / rows))
+    fi
+
+    for halo in $HALOS; do
+      for every in $EVERY; do
+        rm -f "$run"/*
+        (cd "$run" && HEAT_PROFILE=heat.csv $MPIRUN -np $np "$here/heat.out" $ITER $height $width --halo $halo --every $every $OPTIONS > /dev/null)
+        seconds=$(field "$run/heat.csv" total 4)
+        written=$(field "$run/heat.csv" write 7)
+
+        # the means of all the frames written
+        (cd "$run" && HEAT_PROFILE=mean.csv $MPIRUN -np $np "$here/mean.out" --batch 16 $(seq 0 $every $ITER) > /dev/null)
+        mean_seconds=$(field "$run/mean.csv" total 4)
+        read=$(field "$run/mean.csv" read 7)
+
+        awk -v s=$seconds -v w=$written -v ms=$mean_seconds -v r=$read \
+          'BEGIN { printf "%s,%s,%d,%d,%d,%d,%d,%d,%.6f,%.1f,%.3f,%.6f,%.3f\n", \
+                   "'"$LABEL"'", "'"$mode"'", '$np', '$height', '$width', '$halo', '$every', '$ITER', \
+                   s, '$ITER' / s, w / s / 1e9, ms, r / ms / 1e9 }' | tee -a "$OUT"
+      done
+    done
+  done
+done
@@ -0,0 +1,33 @@
+#include "decomp.h"
+
+// Arrange nprocs processes in a psize[0] x psize[1] grid for a problem of fsize[0] x fsize[1] points.
+// The grid minimizes the perimeter of the blocks, i.e. the size of the ghost zones, so that it follows the aspect ratio of the problem.
+// psize[0] is 0 if no grid gives at least one point to every process.
+void splitProcesses(int nprocs, int fsize[2], int psize[2]) {
+  double best = 0;
+  psize[0] = psize[1] = 0;
+
+  for(int rows = 1; rows <= nprocs; rows++) {
+    if(nprocs % rows) continue;
+    int cols = nprocs / rows;
+    if(rows > fsize[0] || cols > fsize[1]) continue;
+
+    // half perimeter of a block
+    double perimeter = (double)fsize[0] / rows + (double)fsize[1] / cols;
+    if(!psize[0] || perimeter < best) {
+      best = perimeter;
+      psize[0] = rows;
+      psize[1] = cols;
+    }
+  }
+}
+
+
+// Split n points in parts parts as evenly as possible: the first n % parts parts get one more point.
+// count and start receive the number of points and the first point of the part idx.
+void splitRange(int n, int parts, int idx, int *count, int *start) {
+  int base = n / parts, remainder = n % parts;
+
+  *count = base + (idx < remainder);
+  *start = idx * base + (idx < remainder ? idx : remainder);
+}
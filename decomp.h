@@ -0,0 +1,8 @@
+#ifndef __DECOMP__
+#define __DECOMP__
+
+void splitProcesses(int nprocs, int fsize[2], int psize[2]);
+
+void splitRange(int n, int parts, int idx, int *count, int *start);
+
+#endif
@@ -1,27 +1,188 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
+#include <pthread.h>
 
 
 #include <mpi.h>
 #include "hdf5IO.h"
+#include "decomp.h"
+#include "analysis.h"
+#include "profile.h"
 
 void Derivative(double* previous_data, double* data, int mdims[2]) {
-  for(int i = 0; i < mdims[0]; i++) {
-    for(int j = 0; j < mdims[1]; j++) {
-      data[i*mdims[1] + j] -= previous_data[i*mdims[1] + j];
+  diffBlock(previous_data, data, mdims[1], mdims[0], mdims[1], data, mdims[1]);
+}
+
+
+// In range mode, a separate thread does all the HDF5 calls, in the order they are requested,
+// so that the next frame is read while the main thread computes the current derivative.
+#define IO_QUEUE 4
+
+typedef struct {
+  // read the frame step in data, or write data as the derivative of the iteration step
+  int read;
+  int step;
+  double *data;
+  // set to 1 when the request is completed
+  int *done;
+} ioRequest;
+
+static struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+
+  ioRequest queue[IO_QUEUE];
+  int head;
+  int count;
+  int stop;
+
+  // the files and the slab of rows of the process
+  int id_heat;
+  int id_de;
+  int *mdims;
+  int *fdims;
+  int yOffset;
+} io;
+
+
+// body of the I/O thread
+static void *ioLoop(void *unused) {
+  (void)unused;
+
+  for(;;) {
+    pthread_mutex_lock(&io.lock);
+    while(io.count == 0 && !io.stop) {
+      pthread_cond_wait(&io.changed, &io.lock);
+    }
+    if(io.count == 0) {
+      pthread_mutex_unlock(&io.lock);
+      return NULL;
+    }
+    ioRequest request = io.queue[io.head];
+    pthread_mutex_unlock(&io.lock);
+
+    if(request.read) {
+      readStep(io.id_heat, request.data, io.mdims, 0, io.fdims, io.yOffset, 0, 1, request.step);
+    } else {
+      int group_id = createGroup(io.id_de, "/%d", request.step);
+      writeFrame(group_id, request.data, io.mdims, 0, io.fdims, io.yOffset, 0, 1, "./derivative");
+      closeGroup(group_id);
+    }
+
+    pthread_mutex_lock(&io.lock);
+    io.head = (io.head + 1) % IO_QUEUE;
+    io.count--;
+    *request.done = 1;
+    pthread_cond_broadcast(&io.changed);
+    pthread_mutex_unlock(&io.lock);
+  }
+}
+
+
+// queue a request to the I/O thread, done is set to 1 once it is completed
+static void requestIO(int read, int step, double *data, int *done) {
+  pthread_mutex_lock(&io.lock);
+  while(io.count == IO_QUEUE) {
+    pthread_cond_wait(&io.changed, &io.lock);
+  }
+  *done = 0;
+  io.queue[(io.head + io.count) % IO_QUEUE] = (ioRequest){read, step, data, done};
+  io.count++;
+  pthread_cond_broadcast(&io.changed);
+  pthread_mutex_unlock(&io.lock);
+}
+
+
+// wait for the completion of a request
+static void waitIO(int *done) {
+  pthread_mutex_lock(&io.lock);
+  while(!*done) {
+    pthread_cond_wait(&io.changed, &io.lock);
+  }
+  pthread_mutex_unlock(&io.lock);
+}
+
+
+// Compute the derivatives of the iterations first, first + stride, ... up to last.
+// Each frame is read once: frames[] lists the iterations needed, s - 1 and s for each derivative, in increasing order.
+// They go through a ring of 3 buffers: the previous frame, the current one and the next one being read.
+static void deriveRange(int first, int last, int stride, int mdims[2]) {
+  int *frames = (int*)malloc(2 * ((last - first) / stride + 1) * sizeof(int));
+  int nb_frames = 0;
+  for(int step = first; step <= last; step += stride) {
+    if(nb_frames == 0 || frames[nb_frames - 1] != step - 1) {
+      frames[nb_frames++] = step - 1;
+    }
+    frames[nb_frames++] = step;
+  }
+
+  double *buffers[3], *out[2];
+  int *readDone = (int*)malloc(nb_frames * sizeof(int));
+  int writeDone[2] = {1, 1};
+  for(int i = 0; i < 3; i++) {
+    buffers[i] = (double*)malloc(mdims[0] * mdims[1] * sizeof(double));
+  }
+  for(int i = 0; i < 2; i++) {
+    out[i] = (double*)malloc(mdims[0] * mdims[1] * sizeof(double));
+  }
+
+  requestIO(1, frames[0], buffers[0], &readDone[0]);
+  for(int f = 0, k = 0; f < nb_frames; f++) {
+    // prefetch the next frame, in the buffer of the frame f - 2 which is no longer needed
+    if(f + 1 < nb_frames) {
+      requestIO(1, frames[f + 1], buffers[(f + 1) % 3], &readDone[f + 1]);
     }
+    waitIO(&readDone[f]);
+
+    // the frames that are only the previous iteration of a derivative
+    if((frames[f] - first) % stride != 0 || frames[f] < first) {
+      continue;
+    }
+
+    // the output buffer is free once its previous derivative is written
+    waitIO(&writeDone[k]);
+    diffBlock(buffers[(f + 2) % 3], buffers[f % 3], mdims[1], mdims[0], mdims[1], out[k], mdims[1]);
+    requestIO(0, frames[f], out[k], &writeDone[k]);
+    k = 1 - k;
+  }
+  waitIO(&writeDone[0]);
+  waitIO(&writeDone[1]);
+
+  for(int i = 0; i < 3; i++) {
+    free(buffers[i]);
+  }
+  for(int i = 0; i < 2; i++) {
+    free(out[i]);
   }
+  free(readDone);
+  free(frames);
 }
 
 int main(int argc, char** argv) {
-  MPI_Init(&argc, &argv);
+  // in range mode, the I/O thread makes all the MPI calls between the initialization and the finalization
+  int range = argc == 3 && !strcmp(argv[1], "--range");
+  int required = range ? MPI_THREAD_SERIALIZED : MPI_THREAD_FUNNELED, provided;
+  MPI_Init_thread(&argc, &argv, required, &provided);
+  if(provided < required) {
+    fprintf(stderr, "The MPI library does not support the threads required.\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  profileInit();
+
+  // the range first:last[:stride]
+  int first = 0, last = 0, stride = 1;
+  if(range && (sscanf(argv[2], "%d:%d:%d", &first, &last, &stride) < 2 || first < 1 || last < first || stride < 1)) {
+    fprintf(stderr, "Invalid range %s, expected first:last[:stride] with 0 < first <= last.\n", argv[2]);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
 
 
   int size, rank;
   MPI_Comm_size(MPI_COMM_WORLD, &size);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  printf("%d %d\n\n", rank, size);
  
   // open heat.h5, diags.h5
   int id_heat = openFile(1, "heat.h5"),
@@ -30,14 +191,45 @@ int main(int argc, char** argv) {
   int fdims[2];
   getDims(id_heat, fdims);
   
-  int mdims[2];
+  // each process reads a slab of rows, the remaining rows are spread over the first processes
+  int mdims[2], yOffset;
   mdims[1] = fdims[1];
-  if(fdims[0] % size) {
-    MPI_Abort(MPI_COMM_WORLD, 1);
-  }
-  mdims[0] = fdims[0] / size;
+  splitRange(fdims[0], size, rank, &mdims[0], &yOffset);
 
 
+  if(range) {
+    io.head = 0;
+    io.count = 0;
+    io.stop = 0;
+    io.id_heat = id_heat;
+    io.id_de = id_de;
+    io.mdims = mdims;
+    io.fdims = fdims;
+    io.yOffset = yOffset;
+    pthread_mutex_init(&io.lock, NULL);
+    pthread_cond_init(&io.changed, NULL);
+    if(pthread_create(&io.thread, NULL, ioLoop, NULL)) {
+      fprintf(stderr, "Unable to start the I/O thread.\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    deriveRange(first, last, stride, mdims);
+
+    pthread_mutex_lock(&io.lock);
+    io.stop = 1;
+    pthread_cond_broadcast(&io.changed);
+    pthread_mutex_unlock(&io.lock);
+    pthread_join(io.thread, NULL);
+    pthread_mutex_destroy(&io.lock);
+    pthread_cond_destroy(&io.changed);
+
+    closeFile(id_heat, 1);
+    closeFile(id_de, 1);
+    profileReport(MPI_COMM_WORLD);
+    MPI_Finalize();
+    return 0;
+  }
+
 
   double* data  = (double*)malloc(mdims[0] * mdims[1] * sizeof(double));
   double* previous_data  = (double*)malloc(mdims[0] * mdims[1] * sizeof(double));
@@ -52,12 +244,12 @@ int main(int argc, char** argv) {
     
     int group_id = createGroup(id_de, "/%d", step);
 
-    readFrame(id_heat, previous_data, mdims, 0, fdims, 0, mdims[0] * rank, 1, "/step%d", step-1);
-    readFrame(id_heat, data         , mdims, 0, fdims, 0, mdims[0] * rank, 1, "/step%d", step);
+    readStep(id_heat, previous_data, mdims, 0, fdims, yOffset, 0, 1, step-1);
+    readStep(id_heat, data         , mdims, 0, fdims, yOffset, 0, 1, step);
 
     Derivative(previous_data, data, mdims);
 
-    writeFrame(group_id, data, mdims, 0, fdims, 0, mdims[0] * rank, 1,"./derivative");
+    writeFrame(group_id, data, mdims, 0, fdims, yOffset, 0, 1,"./derivative");
 
     closeGroup(group_id);
   }
@@ -66,5 +258,6 @@ int main(int argc, char** argv) {
   closeFile(id_de, 1);
 
 
+  profileReport(MPI_COMM_WORLD);
   MPI_Finalize();
 }
@@ -1,15 +1,88 @@
 #include <hdf5.h>
 #include <mpi.h>
 
+#include <stdlib.h>
 #include <stdarg.h>
+#include <glib.h>
 #include <glib/gprintf.h>
 #include <string.h>
-
-// stores all opened files and some properties
-#define MAX_FILE_NUM 10
-hid_t files[MAX_FILE_NUM];
-hid_t plistIds[MAX_FILE_NUM];
-int files_init = 0;
+#include <limits.h>
+
+#include "profile.h"
+
+// stores all opened files and groups and some properties, the tables grow as needed
+hid_t *files = NULL;
+hid_t *plistIds = NULL;
+int nbFiles = 0;
+// the iterations of the time series of the files opened, read by the first call to readSteps (NULL before)
+int **seriesSteps = NULL;
+hsize_t *nbSeriesSteps = NULL;
+// set for the files opened with appendFile, whose frames may have been written by a previous run
+int *appended = NULL;
+// the frames written in each file since it was opened, by name, with their dataset kept open; NULL before the first one
+GHashTable **written = NULL;
+
+// stores all opened time series: the [time][y][x] frames dataset, the dataset of the iteration of each frame, the number of frames
+// and the datatype of the frames in the file, with the transfer property list and the dataspaces reused by all the writes
+typedef struct {
+  hid_t frames;
+  hid_t steps;
+  hsize_t count;
+  hid_t ftype;
+  // collective transfers, for the files opened with multiAccess
+  hid_t dxpl;
+  // the blocks written, resized when the dimensions of the arrays change
+  hid_t mdataspace;
+  hsize_t arraySize[2];
+  // the dataspace of /frames, extended with it
+  hid_t fdataspace;
+  // one iteration, and the dataspace of /steps
+  hid_t stepMdataspace;
+  hid_t stepFdataspace;
+} series_t;
+series_t *series = NULL;
+int nbSeries = 0;
+
+// stores all frame layouts, see createLayout: the dataspaces with their hyperslabs and the property lists
+typedef struct {
+  hid_t mdataspace;
+  hid_t fdataspace;
+  hid_t dcpl;
+  hid_t dxpl;
+  hid_t ftype;
+} layout_t;
+layout_t *layouts = NULL;
+int nbLayouts = 0;
+
+// a block of a subfiled output: the subfile, the position and the size of the block in the frame, the position and the size
+// of the datasets of the subfile in the frame
+#define SUBFILE_BLOCK 9
+
+// stores all subfiled outputs, see createSubfiles: the processes sharing a subfile, the subfile, the layout of the block of
+// the process in its datasets, and on the first process the master file and the regions of the blocks of all processes
+typedef struct {
+  MPI_Comm group;
+  int file;
+  int layout;
+  int master;
+  char name[100];
+  hsize_t frameSize[2];
+  hid_t ftype;
+  int nbBlocks;
+  int (*blocks)[SUBFILE_BLOCK];
+} subfiles_t;
+subfiles_t *subfiles = NULL;
+int nbSubfiles = 0;
+
+// the processes sharing the files opened with multiAccess, see setIOComm
+MPI_Comm ioComm = MPI_COMM_WORLD;
+
+// layout of the frames datasets: chunk dimensions ({0, 0} for contiguous datasets), deflate level (0 for none) and shuffle filter
+int frameChunk[2] = {0, 0};
+int frameDeflate = 0;
+int frameShuffle = 0;
+// datatype of the frames datasets in the file, see setFrameType
+hid_t frameType = -1;
 
 // return the string resulting of sprintf, but using va_list
 #define GET_NAME \
@@ -31,219 +104,841 @@ hid_t H5Guard(hid_t ret) {
 }
 
 
+// Close a dataset kept open in the written table of a file.
+static void closeDataset(gpointer dataset_id) {
+  H5Guard(H5Dclose(*(hid_t*)dataset_id));
+  free(dataset_id);
+}
+
+
+// Return a free slot of the table of files and groups, doubling its size if all are used.
+static int newFile(void) {
+  int i = 0;
+  while(i < nbFiles && files[i] != -1) i++;
+  if(i == nbFiles) {
+    nbFiles = nbFiles ? 2 * nbFiles : 8;
+    files = (hid_t*)realloc(files, nbFiles * sizeof(hid_t));
+    plistIds = (hid_t*)realloc(plistIds, nbFiles * sizeof(hid_t));
+    seriesSteps = (int**)realloc(seriesSteps, nbFiles * sizeof(int*));
+    nbSeriesSteps = (hsize_t*)realloc(nbSeriesSteps, nbFiles * sizeof(hsize_t));
+    appended = (int*)realloc(appended, nbFiles * sizeof(int));
+    written = (GHashTable**)realloc(written, nbFiles * sizeof(GHashTable*));
+    for(int j = i; j < nbFiles; j++) {
+      files[j] = -1;
+      seriesSteps[j] = NULL;
+      written[j] = NULL;
+    }
+  }
+  return i;
+}
+
+
+// Select the processes that open the next files with multiAccess, and take part in the collective operations on them
+// (MPI_COMM_WORLD by default).
+void setIOComm(MPI_Comm comm) {
+  ioComm = comm;
+}
+
+
+// Create the access property list of the files accessed by multiple processes, tuned for the file system by the
+// environment variables:
+//   HDF5IO_HINTS          MPI-IO hints, as key=value pairs separated by commas (e.g. cb_nodes=4,striping_factor=16)
+//   HDF5IO_ALIGNMENT      threshold,alignment: the objects of at least threshold bytes start at a multiple of alignment bytes
+//   HDF5IO_COLL_METADATA  1 to read and write the metadata of the files collectively
+//   HDF5IO_MDC_SIZE       size of the metadata cache, in bytes
+static hid_t fileAccess(void) {
+  hid_t fapl_id = H5Guard(H5Pcreate(H5P_FILE_ACCESS));
+
+  // the hints are only read by the MPI library, which ignores the keys it does not know
+  MPI_Info info = MPI_INFO_NULL;
+  const char *hints = getenv("HDF5IO_HINTS");
+  if( hints && *hints ) {
+    char buffer[1024];
+    if( strlen(hints) >= sizeof(buffer) ) {
+      fprintf(stderr, "HDF5IO_HINTS is too long.\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    strcpy(buffer, hints);
+
+    MPI_Info_create(&info);
+    char *save;
+    for(char *hint = strtok_r(buffer, ",", &save); hint; hint = strtok_r(NULL, ",", &save)) {
+      char *value = strchr(hint, '=');
+      if( !value ) {
+        fprintf(stderr, "Invalid MPI-IO hint %s in HDF5IO_HINTS, expected key=value.\n", hint);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      *value++ = '\0';
+      MPI_Info_set(info, hint, value);
+    }
+  }
+  H5Guard(H5Pset_fapl_mpio(fapl_id, ioComm, info));
+  if( info != MPI_INFO_NULL ) {
+    MPI_Info_free(&info);
+  }
+
+  const char *alignment = getenv("HDF5IO_ALIGNMENT");
+  if( alignment && *alignment ) {
+    unsigned long long threshold, bytes;
+    if( sscanf(alignment, "%llu,%llu", &threshold, &bytes) != 2 || !bytes ) {
+      fprintf(stderr, "Invalid HDF5IO_ALIGNMENT %s, expected threshold,alignment.\n", alignment);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    H5Guard(H5Pset_alignment(fapl_id, threshold, bytes));
+  }
+
+  const char *collective = getenv("HDF5IO_COLL_METADATA");
+  if( collective && atoi(collective) ) {
+#if H5_VERSION_GE(1, 10, 0)
+    H5Guard(H5Pset_coll_metadata_write(fapl_id, 1));
+    H5Guard(H5Pset_all_coll_metadata_ops(fapl_id, 1));
+#else
+    fprintf(stderr, "HDF5IO_COLL_METADATA needs HDF5 >= 1.10.\n");
+#endif
+  }
+
+  const char *cache = getenv("HDF5IO_MDC_SIZE");
+  if( cache && *cache ) {
+    long long size = atoll(cache);
+    if( size <= 0 ) {
+      fprintf(stderr, "Invalid HDF5IO_MDC_SIZE %s.\n", cache);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // the cache starts at the given size and is not allowed to grow above it
+    H5AC_cache_config_t config;
+    config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+    H5Guard(H5Pget_mdc_config(fapl_id, &config));
+    config.set_initial_size = 1;
+    config.initial_size = size;
+    config.max_size = size;
+    if( config.min_size > (size_t)size ) {
+      config.min_size = size;
+    }
+    H5Guard(H5Pset_mdc_config(fapl_id, &config));
+  }
+
+  return fapl_id;
+}
+
+
 // open a file which name is define with (format, ...) using the same syntax as printf.
 // set multiAccess to 1 if the file is going to be accessed by mutltiple processes
 int createFile(int multiAccess, const char* format, ...) {
-  // initialise the array of file id
-  if(!files_init) {
-    for(int i = 0; i < MAX_FILE_NUM; i++) {
-      files[i] = -1;
-    }
-    files_init = 1;
-  }
-  
   // get the name of the file we're trying to open
   GET_NAME
 
   // get MPI rank
   int rank;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_rank(ioComm, &rank);
   
-  // Check the array of ids to find an empty slot
-  for(int i = 0; i < MAX_FILE_NUM; i++) {
-    if(files[i] == -1) {
-      // if the file is going to be accessed by multiple processes
-      if( multiAccess ) {
-        // create access rules
-        plistIds[i] = H5Guard(H5Pcreate(H5P_FILE_ACCESS));
-        H5Guard(H5Pset_fapl_mpio(plistIds[i], MPI_COMM_WORLD, MPI_INFO_NULL));
-        // create HDF5 file
-        files[i] = H5Guard(H5Fcreate(s, H5F_ACC_TRUNC, H5P_DEFAULT, plistIds[i]));
-      } else {
-        // create HDF5 file
-        files[i] = H5Guard(H5Fcreate(s, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT));
-      }
+  // find an empty slot in the array of ids
+  int i = newFile();
 
-      return i;
-    }
+  // if the file is going to be accessed by multiple processes
+  if( multiAccess ) {
+    // create access rules
+    plistIds[i] = fileAccess();
+    // create HDF5 file
+    files[i] = H5Guard(H5Fcreate(s, H5F_ACC_TRUNC, H5P_DEFAULT, plistIds[i]));
+  } else {
+    // create HDF5 file
+    files[i] = H5Guard(H5Fcreate(s, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT));
   }
+  appended[i] = 0;
 
-  // No space left in the ids array to open a new file
-  fprintf(stderr, "Too much files or group opened.\n");
-  MPI_Abort(MPI_COMM_WORLD, 1);
-  exit(1);
+  return i;
+}
+
+
+// open an existing file named s with the access flags of H5Fopen.
+// set multiAccess to 1 if the file is going to be accessed by mutltiple processes
+static int openFileFlags(int multiAccess, const char *s, unsigned flags) {
+  // find an empty slot in the array of ids
+  int i = newFile();
+
+  // if the file is going to be accessed by multiple processes
+  if( multiAccess ) {
+    // create access rules
+    plistIds[i] = fileAccess();
+    // open HDF5 file
+    files[i] = H5Guard(H5Fopen(s, flags, plistIds[i]));
+  } else {
+    // open HDF5 file
+    files[i] = H5Guard(H5Fopen(s, flags, H5P_DEFAULT));
+  }
+  appended[i] = flags == H5F_ACC_RDWR;
+
+  return i;
 }
 
 
 // open a file which name is define with (format, ...) using the same syntax as printf.
 // set multiAccess to 1 if the file is going to be accessed by mutltiple processes
 int openFile(int multiAccess, const char* format, ...) {
-  // initialise the array of file id
-  if(!files_init) {
-    for(int i = 0; i < MAX_FILE_NUM; i++) {
-      files[i] = -1;
-    }
-    files_init = 1;
-  }
-  
   // get the name of the file we're trying to open
   GET_NAME
 
-  // get MPI rank
-  int rank;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  
-  // Check the array of ids to find an empty slot
-  for(int i = 0; i < MAX_FILE_NUM; i++) {
-    if(files[i] == -1) {
-      // if the file is going to be accessed by multiple processes
-      if( multiAccess ) {
-        // create access rules
-        plistIds[i] = H5Guard(H5Pcreate(H5P_FILE_ACCESS));
-        H5Guard(H5Pset_fapl_mpio(plistIds[i], MPI_COMM_WORLD, MPI_INFO_NULL));
-        // create HDF5 file
-        files[i] = H5Guard(H5Fopen(s, H5F_ACC_RDONLY, plistIds[i]));
-      } else {
-        // open HDF5 file
-        files[i] = H5Guard(H5Fopen(s, H5F_ACC_RDONLY, H5P_DEFAULT));
-      }
+  return openFileFlags(multiAccess, s, H5F_ACC_RDONLY);
+}
+
+
+// open a file which name is define with (format, ...) using the same syntax as printf, to add or overwrite frames.
+// set multiAccess to 1 if the file is going to be accessed by mutltiple processes
+int appendFile(int multiAccess, const char* format, ...) {
+  // get the name of the file we're trying to open
+  GET_NAME
 
-      return i;
+  return openFileFlags(multiAccess, s, H5F_ACC_RDWR);
+}
+
+
+// Store the frames written by writeFrame, writeDecimatedFrame and createSeries in chunks of chunkDims points, compressed
+// with the deflate filter at the given level (0 for no compression), preceded by the shuffle filter if shuffle is set.
+// Give chunkDims = {0, 0} to go back to contiguous frames.
+// Compressed frames can only be written collectively when the file is accessed by multiple processes.
+void setCompression(int *chunkDims, int level, int shuffle) {
+  frameChunk[0] = chunkDims[0];
+  frameChunk[1] = chunkDims[1];
+  frameDeflate = level;
+  frameShuffle = shuffle;
+}
+
+
+// Store the frames of the layouts and the series created next in single precision if single is set, in double precision
+// otherwise. The frames are still given in double precision: HDF5 converts them when they are written or read.
+void setFrameType(int single) {
+  frameType = single ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+}
+
+
+// Create the dataset creation property list of a frames dataset of the given rank with the given chunk dimensions,
+// adding the filters selected with setCompression.
+static hid_t frameDcpl(int rank, hsize_t *chunkDims) {
+  hid_t dcpl_id = H5Guard(H5Pcreate(H5P_DATASET_CREATE));
+  H5Guard(H5Pset_chunk(dcpl_id, rank, chunkDims));
+  if( frameShuffle ) {
+    H5Guard(H5Pset_shuffle(dcpl_id));
+  }
+  if( frameDeflate ) {
+    H5Guard(H5Pset_deflate(dcpl_id, frameDeflate));
+  }
+  return dcpl_id;
+}
+
+
+// Compute the hyperslabs selecting one point out of stride in each dimension of a 2D array (see writeDecimatedFrame).
+// Return 1 if no point of the array is selected.
+static int decimate(int *arrayDims, int dataMargin, int stride, int fileXOffset, int fileYOffset, hsize_t memOffset[2], hsize_t fileOffset[2], hsize_t dataSize[2]) {
+  int fileOffsets[2] = {fileXOffset, fileYOffset};
+  int empty = 0;
+  for(int d = 0; d < 2; d++) {
+    // first point of the array which position in the file is a multiple of stride
+    int first = (stride - fileOffsets[d] % stride) % stride;
+    int points = arrayDims[d] - 2 * dataMargin;
+
+    memOffset[d]  = dataMargin + first;
+    fileOffset[d] = (fileOffsets[d] + first) / stride;
+    dataSize[d]   = points > first ? (points - first + stride - 1) / stride : 0;
+    empty |= !dataSize[d];
+  }
+  return empty;
+}
+
+
+// Create the layout of frames of fileDims points, written from or read into arrays of arrayDims points with a margin of
+// dataMargin points, at the position fileXOffset, fileYOffset, keeping one point out of stride in each dimension (see
+// writeDecimatedFrame). The dataspaces with their hyperslabs, the transfer and creation property lists are created once,
+// so that writing or reading a frame with writeLayoutFrame or readLayoutFrame only costs the access to its dataset.
+// Return an id to give to these functions and to closeLayout.
+int createLayout(int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess) {
+  // find an empty slot in the array of layouts, doubling its size if all are used
+  int i = 0;
+  while(i < nbLayouts && layouts[i].mdataspace != -1) i++;
+  if(i == nbLayouts) {
+    nbLayouts = nbLayouts ? 2 * nbLayouts : 4;
+    layouts = (layout_t*)realloc(layouts, nbLayouts * sizeof(layout_t));
+    for(int j = i; j < nbLayouts; j++) {
+      layouts[j].mdataspace = -1;
     }
   }
+  layout_t *layout = &layouts[i];
 
-  // No space left in the ids array to open a new file
-  fprintf(stderr, "Too much files opened.\n");
-  MPI_Abort(MPI_COMM_WORLD, 1);
-  exit(1);
+  // initialise arrays defining size and offset for the dataspaces and hyperslabs
+  hsize_t arraySize[2]  = {arrayDims[0], arrayDims[1]};
+  hsize_t fileSize[2]   = {(fileDims[0] + stride - 1) / stride, (fileDims[1] + stride - 1) / stride};
+
+  hsize_t memOffset[2], fileOffset[2], dataSize[2], memStride[2] = {stride, stride};
+  int empty = decimate(arrayDims, dataMargin, stride, fileXOffset, fileYOffset, memOffset, fileOffset, dataSize);
+
+  // create dataspace for the file and the memory
+  layout->mdataspace = H5Guard(H5Screate_simple(2, arraySize, NULL));
+  layout->fdataspace = H5Guard(H5Screate_simple(2, fileSize, NULL));
+
+  // create the hyperslabs, the process still takes part in collective accesses when none of its points are kept
+  if( empty ) {
+    H5Guard(H5Sselect_none(layout->mdataspace));
+    H5Guard(H5Sselect_none(layout->fdataspace));
+  } else {
+    H5Guard(H5Sselect_hyperslab(layout->mdataspace, H5S_SELECT_SET, memOffset,  memStride, dataSize, NULL));
+    H5Guard(H5Sselect_hyperslab(layout->fdataspace, H5S_SELECT_SET, fileOffset, NULL,      dataSize, NULL));
+  }
+
+  // the frames are chunked if asked by setCompression
+  layout->dcpl = H5P_DEFAULT;
+  if( frameChunk[0] && fileSize[0] && fileSize[1] ) {
+    hsize_t chunkSize[2] = {
+      frameChunk[0] < fileSize[0] ? frameChunk[0] : fileSize[0],
+      frameChunk[1] < fileSize[1] ? frameChunk[1] : fileSize[1]
+    };
+    layout->dcpl = frameDcpl(2, chunkSize);
+  }
+
+  layout->dxpl = H5P_DEFAULT;
+  if( multiAccess ) {
+    layout->dxpl = H5Guard(H5Pcreate(H5P_DATASET_XFER));
+    H5Guard(H5Pset_dxpl_mpio(layout->dxpl, H5FD_MPIO_COLLECTIVE));
+  }
+
+  // the datatype of the frames created, see setFrameType
+  layout->ftype = frameType == -1 ? H5T_NATIVE_DOUBLE : frameType;
+
+  return i;
 }
 
 
+
+// Write a frame with the layout defined by layout in the HDF5 file defined by id, in the dataset which name is defined
+// with (format, ...) using the same syntax as printf.
+void writeLayoutFrame(int layout, int id, double *data, const char* format, ...) {
+  // get the name of the dataset we're writing in
+  GET_NAME
+
+  // the first write of a frame since the file was opened creates it, replacing the frame of a previous run in a file opened
+  // with appendFile, which may have another layout; the dataset stays open for the next writes of the frame (other blocks
+  // or rows) until the file is closed
+  if( !written[id] ) {
+    written[id] = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, closeDataset);
+  }
+  hid_t *dataset_id = (hid_t*)g_hash_table_lookup(written[id], s);
+  if( !dataset_id ) {
+    if( appended[id] && H5Guard(H5Lexists(files[id], s, H5P_DEFAULT)) ) {
+      H5Guard(H5Ldelete(files[id], s, H5P_DEFAULT));
+    }
+    dataset_id = (hid_t*)malloc(sizeof(hid_t));
+    *dataset_id = H5Guard(H5Dcreate(files[id], s, layouts[layout].ftype, layouts[layout].fdataspace, H5P_DEFAULT, layouts[layout].dcpl, H5P_DEFAULT));
+    g_hash_table_insert(written[id], g_strdup(s), dataset_id);
+  }
+
+  PROFILE_START(PROFILE_WRITE);
+  H5Guard(H5Dwrite(*dataset_id, H5T_NATIVE_DOUBLE, layouts[layout].mdataspace, layouts[layout].fdataspace, layouts[layout].dxpl, data));
+  PROFILE_STOP(PROFILE_WRITE, H5Sget_select_npoints(layouts[layout].mdataspace) * H5Tget_size(layouts[layout].ftype));
+}
+
+
+
+// Return the size of a point of the dataset in the file, so that the reads count the bytes of the file as the writes do.
+static size_t datasetTypeSize(hid_t dataset_id) {
+  hid_t ftype = H5Guard(H5Dget_type(dataset_id));
+  size_t size = H5Tget_size(ftype);
+  H5Guard(H5Tclose(ftype));
+  return size;
+}
+
+
+
+// Read a frame with the layout defined by layout from the HDF5 file defined by id, in the dataset which name is defined
+// with (format, ...) using the same syntax as printf.
+void readLayoutFrame(int layout, int id, double *data, const char* format, ...) {
+  // get the name of the dataset we're reading
+  GET_NAME
+
+  hid_t dataset_id = H5Guard(H5Dopen(files[id], s, H5P_DEFAULT));
+  PROFILE_START(PROFILE_READ);
+  H5Guard(H5Dread(dataset_id, H5T_NATIVE_DOUBLE, layouts[layout].mdataspace, layouts[layout].fdataspace, layouts[layout].dxpl, data));
+  PROFILE_STOP(PROFILE_READ, H5Sget_select_npoints(layouts[layout].mdataspace) * datasetTypeSize(dataset_id));
+  H5Guard(H5Dclose(dataset_id));
+}
+
+
+
+// Close the layout
+void closeLayout(int layout) {
+  H5Guard(H5Sclose(layouts[layout].mdataspace));
+  H5Guard(H5Sclose(layouts[layout].fdataspace));
+  if( layouts[layout].dcpl != H5P_DEFAULT ) {
+    H5Guard(H5Pclose(layouts[layout].dcpl));
+  }
+  if( layouts[layout].dxpl != H5P_DEFAULT ) {
+    H5Guard(H5Pclose(layouts[layout].dxpl));
+  }
+
+  layouts[layout].mdataspace = -1;
+}
+
+
+
 // Write in the HDF5 file defined by id, in the dataset which name is defined with (format, ...) using the same syntax as printf,  a 2D array.
 // dataMargin defines the size of the margin of the 2D array which is no going to be written in the file.
 // fileDims defines the dimension of the file.
 // The data array will be written in the file at the position defined by fileXOffset and fileYOffset
+// To write many frames with the same arguments, use createLayout and writeLayoutFrame instead.
 void writeFrame(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, const char* format, ...) {
   // get the name of the dataset we're writing in
   GET_NAME
- 
-  // get the MPI rank
-  int rank;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  int layout = createLayout(arrayDims, dataMargin, 1, fileDims, fileXOffset, fileYOffset, multiAccess);
+  writeLayoutFrame(layout, id, data, "%s", s);
+  closeLayout(layout);
+}
 
 
-  
-  // initialise arrays defining size and offset for the dataspaces and hyperslabs
-  hsize_t arraySize[2]  = {arrayDims[0], arrayDims[1]};
-  hsize_t memOffset[2]  = {dataMargin, dataMargin};
 
-  hsize_t fileSize[2]   = {fileDims[0], fileDims[1]};
-  hsize_t fileOffset[2] = {fileXOffset, fileYOffset};
+// Same as writeFrame, but only one point out of stride in each dimension is written.
+// The selection of the hyperslabs does the decimation, so the data array is not copied.
+// Only the points whose position in the file is a multiple of stride are written, in a dataset of fileDims / stride points (rounded up).
+void writeDecimatedFrame(int id, double *data, int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, const char* format, ...) {
+  // get the name of the dataset we're writing in
+  GET_NAME
+
+  int layout = createLayout(arrayDims, dataMargin, stride, fileDims, fileXOffset, fileYOffset, multiAccess);
+  writeLayoutFrame(layout, id, data, "%s", s);
+  closeLayout(layout);
+}
 
-  hsize_t dataSize[2]   = {arraySize[0] - 2 * dataMargin, arraySize[1] - 2 * dataMargin};
 
 
-  hid_t mdataspace_id = 0;
-  hid_t fdataspace_id = 0;
-  hid_t dataset_id    = 0;
+// Read from the HDF5 file defined by id, in the dataset which name is defined with (format, ...) using the same syntax as printf,  a 2D array.
+// dataMargin defines the size of the margin of the 2D array which is no going to be written in the file.
+// fileDims defines the dimension of the file.
+// The data array will be written in the file at the position defined by fileXOffset and fileYOffset
+// To read many frames with the same arguments, use createLayout and readLayoutFrame instead.
+void readFrame(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, const char* format, ...) {
+  // get the name of the dataset we're reading
+  GET_NAME
 
-  // create dataspace for the file and the memory
-  mdataspace_id = H5Guard(H5Screate_simple(2, arraySize, NULL));
-  fdataspace_id = H5Guard(H5Screate_simple(2, fileSize, NULL));
+  int layout = createLayout(arrayDims, dataMargin, 1, fileDims, fileXOffset, fileYOffset, multiAccess);
+  readLayoutFrame(layout, id, data, "%s", s);
+  closeLayout(layout);
+}
+
+
+
+// Close the HDF5 file
+void closeFile(int id, int multiAccess) {
+
+  // close the access rules
+  if( multiAccess ) {
+    H5Guard(H5Pclose(plistIds[id]));
+  }
+
+  // close the frames still open, then the file
+  if( written[id] ) {
+    g_hash_table_destroy(written[id]);
+    written[id] = NULL;
+  }
+  H5Guard(H5Fclose (files[id]));
+  free(seriesSteps[id]);
+  seriesSteps[id] = NULL;
   
+  // set the id back to -1 to mark it free to be used again
+  files[id] = -1;
+}
 
 
-  // create the dataset
-  dataset_id = H5Guard(H5Dcreate(files[id], s, H5T_NATIVE_DOUBLE, fdataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+// Attach to the object (dataset or group) named object of the HDF5 file defined by id an integer attribute.
+// All the processes sharing the file must write the same value.
+void writeIntAttribute(int id, const char *object, const char *name, int value) {
+  hid_t dataspace_id = H5Guard(H5Screate(H5S_SCALAR));
+  hid_t attribute_id = H5Guard(H5Acreate_by_name(files[id], object, name, H5T_NATIVE_INT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+  H5Guard(H5Awrite(attribute_id, H5T_NATIVE_INT, &value));
+  H5Guard(H5Aclose(attribute_id));
+  H5Guard(H5Sclose(dataspace_id));
+}
 
 
 
-  // create the hyperslabs
-  H5Guard(H5Sselect_hyperslab(mdataspace_id, H5S_SELECT_SET, memOffset,  NULL, dataSize, NULL));
-  H5Guard(H5Sselect_hyperslab(fdataspace_id, H5S_SELECT_SET, fileOffset, NULL, dataSize, NULL));
+// Read the integer attribute written by writeIntAttribute.
+int readIntAttribute(int id, const char *object, const char *name) {
+  int value;
+  hid_t attribute_id = H5Guard(H5Aopen_by_name(files[id], object, name, H5P_DEFAULT, H5P_DEFAULT));
+  H5Guard(H5Aread(attribute_id, H5T_NATIVE_INT, &value));
+  H5Guard(H5Aclose(attribute_id));
+  return value;
+}
 
 
 
-  // write in the file
-  if( multiAccess ) {
-    hid_t plist_id = H5Guard(H5Pcreate(H5P_DATASET_XFER));
-    H5Guard(H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE));
+// Store in the root attributes height and width of the HDF5 file defined by id the dimensions of its frames of fileDims
+// points, written with one point out of stride in each dimension. getDims reads them, whichever frames the file holds.
+void writeFrameDims(int id, int *fileDims, int stride) {
+  writeIntAttribute(id, "/", "height", (fileDims[0] + stride - 1) / stride);
+  writeIntAttribute(id, "/", "width", (fileDims[1] + stride - 1) / stride);
+}
 
-    H5Guard(H5Dwrite(dataset_id, H5T_NATIVE_DOUBLE, mdataspace_id, fdataspace_id, plist_id, data));
-    
-    H5Guard(H5Pclose(plist_id));
+
+// Get the dimensions of the frames of the file, stored by writeFrameDims, or for older files taken from /step0 or from the
+// time series /frames
+void getDims(int id, int dims[2]) {
+  if( H5Guard(H5Aexists_by_name(files[id], "/", "height", H5P_DEFAULT)) ) {
+    dims[0] = readIntAttribute(id, "/", "height");
+    dims[1] = readIntAttribute(id, "/", "width");
+    return;
+  }
+
+  hsize_t dim[3];
+
+  hid_t dataset_id;
+  if( H5Guard(H5Lexists(files[id], "/step0", H5P_DEFAULT)) ) {
+    dataset_id = H5Guard(H5Dopen(files[id], "/step0", H5P_DEFAULT));
   } else {
-    H5Guard(H5Dwrite(dataset_id, H5T_NATIVE_DOUBLE, mdataspace_id, fdataspace_id, H5P_DEFAULT, data));
+    dataset_id = H5Guard(H5Dopen(files[id], "/frames", H5P_DEFAULT));
   }
 
+  hid_t dataspace_id = H5Guard(H5Dget_space(dataset_id));
+  int rank = H5Guard(H5Sget_simple_extent_dims(dataspace_id, dim, NULL));
 
-  //close dataset and dataspaces
+  H5Guard(H5Sclose(dataspace_id));
   H5Guard(H5Dclose(dataset_id));
-  H5Guard(H5Sclose(mdataspace_id));
-  H5Guard(H5Sclose(fdataspace_id));
+
+  // the first dimension of a time series is the time
+  dims[0] = dim[rank - 2]; dims[1] = dim[rank - 1];
 }
 
 
 
-// Read from the HDF5 file defined by id, in the dataset which name is defined with (format, ...) using the same syntax as printf,  a 2D array.
-// dataMargin defines the size of the margin of the 2D array which is no going to be written in the file.
-// fileDims defines the dimension of the file.
-// The data array will be written in the file at the position defined by fileXOffset and fileYOffset
-void readFrame(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, const char* format, ...) {
-  // get the name of the dataset we're writing in
-  GET_NAME
- 
-  // get the MPI rank
+// Return a free slot of the table of time series, doubling its size if all are used.
+static int newSeries(void) {
+  int i = 0;
+  while(i < nbSeries && series[i].frames != -1) i++;
+  if(i == nbSeries) {
+    nbSeries = nbSeries ? 2 * nbSeries : 4;
+    series = (series_t*)realloc(series, nbSeries * sizeof(series_t));
+    for(int j = i; j < nbSeries; j++) {
+      series[j].frames = -1;
+    }
+  }
+  return i;
+}
+
+
+
+// Create the property list and the dataspaces kept by the time series i, once its datasets are open.
+static void initSeries(int i) {
+  series[i].ftype = H5Guard(H5Dget_type(series[i].frames));
+
+  series[i].dxpl = H5Guard(H5Pcreate(H5P_DATASET_XFER));
+  H5Guard(H5Pset_dxpl_mpio(series[i].dxpl, H5FD_MPIO_COLLECTIVE));
+
+  series[i].arraySize[0] = series[i].arraySize[1] = 1;
+  series[i].mdataspace = H5Guard(H5Screate_simple(2, series[i].arraySize, NULL));
+  series[i].fdataspace = H5Guard(H5Dget_space(series[i].frames));
+
+  hsize_t one[1] = {1};
+  series[i].stepMdataspace = H5Guard(H5Screate_simple(1, one, NULL));
+  series[i].stepFdataspace = H5Guard(H5Dget_space(series[i].steps));
+}
+
+
+
+// Create in the HDF5 file defined by id a time series of frames of fileDims points.
+// The frames are stored in a single extendible dataset /frames of dimensions [time][fileDims[0]][fileDims[1]],
+// chunked by chunkDims points in each frame, and /steps stores the iteration of each frame.
+// Return an id to give to writeSeriesFrame.
+int createSeries(int id, int *fileDims, int *chunkDims) {
+  // find an empty slot in the array of series
+  int i = newSeries();
+
+  // the frames, the time dimension is unlimited
+  hsize_t frameSize[3] = {0, fileDims[0], fileDims[1]};
+  hsize_t frameMax[3]  = {H5S_UNLIMITED, fileDims[0], fileDims[1]};
+  hsize_t seriesChunk[3] = {1, chunkDims[0] < fileDims[0] ? chunkDims[0] : fileDims[0], chunkDims[1] < fileDims[1] ? chunkDims[1] : fileDims[1]};
+
+  hid_t dataspace_id = H5Guard(H5Screate_simple(3, frameSize, frameMax));
+  hid_t dcpl_id = frameDcpl(3, seriesChunk);
+  series[i].frames = H5Guard(H5Dcreate(files[id], "/frames", frameType == -1 ? H5T_NATIVE_DOUBLE : frameType, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT));
+  H5Guard(H5Pclose(dcpl_id));
+  H5Guard(H5Sclose(dataspace_id));
+
+  // the iteration of each frame
+  hsize_t stepSize[1] = {0}, stepMax[1] = {H5S_UNLIMITED}, stepChunk[1] = {1024};
+  dataspace_id = H5Guard(H5Screate_simple(1, stepSize, stepMax));
+  dcpl_id = H5Guard(H5Pcreate(H5P_DATASET_CREATE));
+  H5Guard(H5Pset_chunk(dcpl_id, 1, stepChunk));
+  series[i].steps = H5Guard(H5Dcreate(files[id], "/steps", H5T_NATIVE_INT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT));
+  H5Guard(H5Pclose(dcpl_id));
+  H5Guard(H5Sclose(dataspace_id));
+
+  series[i].count = 0;
+  initSeries(i);
+  return i;
+}
+
+
+
+// Open the time series of the HDF5 file defined by id, opened with appendFile, to continue it after the iteration step.
+// The frames of the iterations after step are removed, the next calls to writeSeriesFrame append the following ones.
+// Return an id to give to writeSeriesFrame.
+int openSeries(int id, int step) {
+  // find an empty slot in the array of series
+  int i = newSeries();
+
+  series[i].frames = H5Guard(H5Dopen(files[id], "/frames", H5P_DEFAULT));
+  series[i].steps  = H5Guard(H5Dopen(files[id], "/steps", H5P_DEFAULT));
+
+  // keep the frames up to the iteration step, they are stored in increasing order
+  hsize_t count;
+  hid_t dataspace_id = H5Guard(H5Dget_space(series[i].steps));
+  H5Guard(H5Sget_simple_extent_dims(dataspace_id, &count, NULL));
+  H5Guard(H5Sclose(dataspace_id));
+
+  int *steps = (int*)malloc(count * sizeof(int));
+  if( count ) {
+    H5Guard(H5Dread(series[i].steps, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, steps));
+  }
+  series[i].count = 0;
+  while(series[i].count < count && steps[series[i].count] <= step) series[i].count++;
+  free(steps);
+
+  // a run stopped after step may have written more frames than the next one will
+  if( series[i].count < count ) {
+    hsize_t frameSize[3];
+    dataspace_id = H5Guard(H5Dget_space(series[i].frames));
+    H5Guard(H5Sget_simple_extent_dims(dataspace_id, frameSize, NULL));
+    H5Guard(H5Sclose(dataspace_id));
+    frameSize[0] = series[i].count;
+    H5Guard(H5Dset_extent(series[i].frames, frameSize));
+    H5Guard(H5Dset_extent(series[i].steps, &series[i].count));
+  }
+
+  initSeries(i);
+
+  return i;
+}
+
+
+
+// Write a block of a frame in the slice t of the time series defined by id, with the transfer properties plist_id.
+static void writeSeriesSlice(int id, hsize_t t, double *data, int *arrayDims, int dataMargin, int stride, int fileXOffset, int fileYOffset, hid_t plist_id) {
+  hsize_t memOffset[2], memStride[2] = {stride, stride}, offset[2], count[2];
+  int empty = decimate(arrayDims, dataMargin, stride, fileXOffset, fileYOffset, memOffset, offset, count);
+
+  hsize_t fileOffset[3] = {t, offset[0], offset[1]};
+  hsize_t dataSize[3]   = {1, count[0], count[1]};
+
+  hid_t mdataspace_id = series[id].mdataspace;
+  hid_t fdataspace_id = series[id].fdataspace;
+  if( series[id].arraySize[0] != (hsize_t)arrayDims[0] || series[id].arraySize[1] != (hsize_t)arrayDims[1] ) {
+    series[id].arraySize[0] = arrayDims[0];
+    series[id].arraySize[1] = arrayDims[1];
+    H5Guard(H5Sset_extent_simple(mdataspace_id, 2, series[id].arraySize, NULL));
+  }
+  if( empty ) {
+    H5Guard(H5Sselect_none(mdataspace_id));
+    H5Guard(H5Sselect_none(fdataspace_id));
+  } else {
+    H5Guard(H5Sselect_hyperslab(mdataspace_id, H5S_SELECT_SET, memOffset,  memStride, count, NULL));
+    H5Guard(H5Sselect_hyperslab(fdataspace_id, H5S_SELECT_SET, fileOffset, NULL, dataSize, NULL));
+  }
+  PROFILE_START(PROFILE_WRITE);
+  H5Guard(H5Dwrite(series[id].frames, H5T_NATIVE_DOUBLE, mdataspace_id, fdataspace_id, plist_id, data));
+  PROFILE_STOP(PROFILE_WRITE, H5Sget_select_npoints(mdataspace_id) * H5Tget_size(series[id].ftype));
+}
+
+
+
+// Append a frame for the iteration step to the time series defined by id, see writeDecimatedFrame for the other arguments.
+// All the processes sharing the file must append the same frames, in the same order.
+void writeSeriesFrame(int id, int step, double *data, int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess) {
+  hid_t plist_id = multiAccess ? series[id].dxpl : H5P_DEFAULT;
+
   int rank;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_rank(ioComm, &rank);
+
+  hsize_t t = series[id].count++;
+
+  // grow the time dimension of both datasets
+  hsize_t frameSize[3] = {t + 1, (fileDims[0] + stride - 1) / stride, (fileDims[1] + stride - 1) / stride};
+  hsize_t frameMax[3]  = {H5S_UNLIMITED, frameSize[1], frameSize[2]};
+  hsize_t stepSize[1]  = {t + 1}, stepMax[1] = {H5S_UNLIMITED};
+  H5Guard(H5Dset_extent(series[id].frames, frameSize));
+  H5Guard(H5Dset_extent(series[id].steps, stepSize));
+  H5Guard(H5Sset_extent_simple(series[id].fdataspace, 3, frameSize, frameMax));
+  H5Guard(H5Sset_extent_simple(series[id].stepFdataspace, 1, stepSize, stepMax));
+
+  // write the frame in the slice t
+  writeSeriesSlice(id, t, data, arrayDims, dataMargin, stride, fileXOffset, fileYOffset, plist_id);
+
+  // the first process writes the iteration of the frame
+  hsize_t one[1] = {1};
+  hid_t mdataspace_id = series[id].stepMdataspace;
+  hid_t fdataspace_id = series[id].stepFdataspace;
+  if( rank == 0 || !multiAccess ) {
+    H5Guard(H5Sselect_all(mdataspace_id));
+    H5Guard(H5Sselect_hyperslab(fdataspace_id, H5S_SELECT_SET, &t, NULL, one, NULL));
+  } else {
+    H5Guard(H5Sselect_none(mdataspace_id));
+    H5Guard(H5Sselect_none(fdataspace_id));
+  }
+  H5Guard(H5Dwrite(series[id].steps, H5T_NATIVE_INT, mdataspace_id, fdataspace_id, plist_id, &step));
+}
 
 
-  
-  // initialise arrays defining size and offset for the dataspaces and hyperslabs
-  hsize_t arraySize[2]  = {arrayDims[0], arrayDims[1]};
-  hsize_t memOffset[2]  = {dataMargin, dataMargin};
 
-  hsize_t fileSize[2]   = {fileDims[0], fileDims[1]};
-  hsize_t fileOffset[2] = {fileXOffset, fileYOffset};
+// Write another block of the last frame appended with writeSeriesFrame, for the processes that hold several blocks of the frame.
+// All the processes sharing the file must write the same number of blocks.
+void writeSeriesBlock(int id, double *data, int *arrayDims, int dataMargin, int stride, int fileXOffset, int fileYOffset, int multiAccess) {
+  writeSeriesSlice(id, series[id].count - 1, data, arrayDims, dataMargin, stride, fileXOffset, fileYOffset, multiAccess ? series[id].dxpl : H5P_DEFAULT);
+}
 
-  hsize_t dataSize[2]   = {arraySize[0] - 2 * dataMargin, arraySize[1] - 2 * dataMargin};
 
 
-  hid_t mdataspace_id = 0;
-  hid_t fdataspace_id = 0;
-  hid_t dataset_id    = 0;
+// Close the time series
+void closeSeries(int id) {
+  H5Guard(H5Dclose(series[id].frames));
+  H5Guard(H5Dclose(series[id].steps));
+  H5Guard(H5Tclose(series[id].ftype));
+  H5Guard(H5Pclose(series[id].dxpl));
+  H5Guard(H5Sclose(series[id].mdataspace));
+  H5Guard(H5Sclose(series[id].fdataspace));
+  H5Guard(H5Sclose(series[id].stepMdataspace));
+  H5Guard(H5Sclose(series[id].stepFdataspace));
 
-  // create dataspace for the file and the memory
-  mdataspace_id = H5Guard(H5Screate_simple(2, arraySize, NULL));
-  fdataspace_id = H5Guard(H5Screate_simple(2, fileSize, NULL));
-  
+  series[id].frames = -1;
+}
+
+
+
+// Order two integers, for bsearch
+static int compareInt(const void *a, const void *b) {
+  int x = *(const int*)a, y = *(const int*)b;
+  return (x > y) - (x < y);
+}
 
 
-  // create the dataset
-  dataset_id = H5Guard(H5Dopen(files[id], s, H5P_DEFAULT));
 
+// Read the frames of the nb iterations steps in nb consecutive arrays of arrayDims points, see readFrame for the other arguments.
+// The frames are either the datasets /step<step> or slices of the time series /frames.
+// The slices of a time series are read by a single H5Dread for each run of slices in increasing order.
+void readSteps(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, int nb, int *steps) {
+  char name[100];
+  sprintf(name, "/step%d", steps[0]);
+  if( H5Guard(H5Lexists(files[id], name, H5P_DEFAULT)) ) {
+    int layout = createLayout(arrayDims, dataMargin, 1, fileDims, fileXOffset, fileYOffset, multiAccess);
+    for(int k = 0; k < nb; k++) {
+      readLayoutFrame(layout, id, &data[k * arrayDims[0] * arrayDims[1]], "/step%d", steps[k]);
+    }
+    closeLayout(layout);
+    return;
+  }
 
+  if( !H5Guard(H5Lexists(files[id], "/steps", H5P_DEFAULT)) ) {
+    fprintf(stderr, "No frame for the iteration %d.\n", steps[0]);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
 
-  // open the hyperslabs
-  H5Guard(H5Sselect_hyperslab(mdataspace_id, H5S_SELECT_SET, memOffset,  NULL, dataSize, NULL));
-  H5Guard(H5Sselect_hyperslab(fdataspace_id, H5S_SELECT_SET, fileOffset, NULL, dataSize, NULL));
+  // the iterations of the time series are read once per file, in increasing order
+  if( !seriesSteps[id] ) {
+    hid_t steps_id = H5Guard(H5Dopen(files[id], "/steps", H5P_DEFAULT));
+    hid_t dataspace_id = H5Guard(H5Dget_space(steps_id));
+    H5Guard(H5Sget_simple_extent_dims(dataspace_id, &nbSeriesSteps[id], NULL));
+    H5Guard(H5Sclose(dataspace_id));
 
+    seriesSteps[id] = (int*)malloc((nbSeriesSteps[id] ? nbSeriesSteps[id] : 1) * sizeof(int));
+    if( nbSeriesSteps[id] ) {
+      H5Guard(H5Dread(steps_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, seriesSteps[id]));
+    }
+    H5Guard(H5Dclose(steps_id));
+  }
 
+  // find the slices of the time series holding the iterations
+  hsize_t *slices = (hsize_t*)malloc(nb * sizeof(hsize_t));
+  for(int k = 0; k < nb; k++) {
+    int *slice = (int*)bsearch(&steps[k], seriesSteps[id], nbSeriesSteps[id], sizeof(int), compareInt);
+    if( !slice ) {
+      fprintf(stderr, "No frame for the iteration %d.\n", steps[k]);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    slices[k] = slice - seriesSteps[id];
+  }
 
-  // read in the file
+  hid_t dataset_id = H5Guard(H5Dopen(files[id], "/frames", H5P_DEFAULT));
+  hid_t plist_id = H5P_DEFAULT;
   if( multiAccess ) {
-    hid_t plist_id = H5Guard(H5Pcreate(H5P_DATASET_XFER));
+    plist_id = H5Guard(H5Pcreate(H5P_DATASET_XFER));
     H5Guard(H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE));
+  }
+
+  // the points of a selection are transferred in the order of the file, so each read covers a run of increasing slices
+  for(int first = 0, last; first < nb; first = last) {
+    last = first + 1;
+    while(last < nb && slices[last] > slices[last - 1]) last++;
+
+    hsize_t arraySize[3]  = {last - first, arrayDims[0], arrayDims[1]};
+    hsize_t dataSize[3]   = {1, arraySize[1] - 2 * dataMargin, arraySize[2] - 2 * dataMargin};
+
+    hid_t mdataspace_id = H5Guard(H5Screate_simple(3, arraySize, NULL));
+    hid_t fdataspace_id = H5Guard(H5Dget_space(dataset_id));
+    H5Guard(H5Sselect_none(mdataspace_id));
+    H5Guard(H5Sselect_none(fdataspace_id));
+    for(int k = first; k < last; k++) {
+      hsize_t memOffset[3]  = {k - first, dataMargin, dataMargin};
+      hsize_t fileOffset[3] = {slices[k], fileXOffset, fileYOffset};
+      H5Guard(H5Sselect_hyperslab(mdataspace_id, H5S_SELECT_OR, memOffset,  NULL, dataSize, NULL));
+      H5Guard(H5Sselect_hyperslab(fdataspace_id, H5S_SELECT_OR, fileOffset, NULL, dataSize, NULL));
+    }
+
+    PROFILE_START(PROFILE_READ);
+    H5Guard(H5Dread(dataset_id, H5T_NATIVE_DOUBLE, mdataspace_id, fdataspace_id, plist_id, &data[first * arrayDims[0] * arrayDims[1]]));
+    PROFILE_STOP(PROFILE_READ, H5Sget_select_npoints(mdataspace_id) * datasetTypeSize(dataset_id));
+
+    H5Guard(H5Sclose(mdataspace_id));
+    H5Guard(H5Sclose(fdataspace_id));
+  }
+  free(slices);
 
-    H5Guard(H5Dread(dataset_id, H5T_NATIVE_DOUBLE, mdataspace_id, fdataspace_id, plist_id, data));
-    
+  if( multiAccess ) {
     H5Guard(H5Pclose(plist_id));
-  } else {
-    H5Guard(H5Dread(dataset_id, H5T_NATIVE_DOUBLE, mdataspace_id, fdataspace_id, H5P_DEFAULT, data));
   }
+  H5Guard(H5Dclose(dataset_id));
+}
+
 
 
-  //close dataset and dataspaces
+// Read from the HDF5 file defined by id the frame of the iteration step, see readFrame for the other arguments.
+void readStep(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, int step) {
+  readSteps(id, data, arrayDims, dataMargin, fileDims, fileXOffset, fileYOffset, multiAccess, 1, &step);
+}
+
+
+
+// Write in the HDF5 file defined by id, in the dataset which name is defined with (format, ...), a 1D array of count integers.
+// With multiAccess, the first process writes the values and the others only take part in the collective operations.
+void writeIntArray(int id, int *values, int count, int multiAccess, const char* format, ...) {
+  GET_NAME
+
+  int rank;
+  MPI_Comm_rank(ioComm, &rank);
+
+  hsize_t size[1] = {count};
+  hid_t mdataspace_id = H5Guard(H5Screate_simple(1, size, NULL));
+  hid_t fdataspace_id = H5Guard(H5Screate_simple(1, size, NULL));
+  hid_t dataset_id = H5Guard(H5Dcreate(files[id], s, H5T_NATIVE_INT, fdataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+
+  hid_t plist_id = H5P_DEFAULT;
+  if( multiAccess ) {
+    plist_id = H5Guard(H5Pcreate(H5P_DATASET_XFER));
+    H5Guard(H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE));
+    if( rank != 0 ) {
+      H5Guard(H5Sselect_none(mdataspace_id));
+      H5Guard(H5Sselect_none(fdataspace_id));
+    }
+  }
+  H5Guard(H5Dwrite(dataset_id, H5T_NATIVE_INT, mdataspace_id, fdataspace_id, plist_id, values));
+
+  if( multiAccess ) {
+    H5Guard(H5Pclose(plist_id));
+  }
   H5Guard(H5Dclose(dataset_id));
   H5Guard(H5Sclose(mdataspace_id));
   H5Guard(H5Sclose(fdataspace_id));
@@ -251,55 +946,205 @@ void readFrame(int id, double *data, int *arrayDims, int dataMargin, int *fileDi
 
 
 
-// Close the HDF5 file
-void closeFile(int id, int multiAccess) {
 
-  // close the access rules
-  if( multiAccess ) {
-    H5Guard(H5Pclose(plistIds[id]));
+int createGroup(int id, const char* format, ...) {
+  // get the name of the file we're trying to open
+  GET_NAME
+
+  // find an empty slot in the array of ids
+  int i = newFile();
+
+  // a group already written in a file opened with appendFile is replaced
+  if( H5Guard(H5Lexists(files[id], s, H5P_DEFAULT)) ) {
+    H5Guard(H5Ldelete(files[id], s, H5P_DEFAULT));
   }
+  files[i] = H5Guard(H5Gcreate( files[id], s, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+  appended[i] = 0;
+  return i;
+}
 
-  // close the file
-  H5Guard(H5Fclose (files[id]));
+void closeGroup(int id) {
+  if( written[id] ) {
+    g_hash_table_destroy(written[id]);
+    written[id] = NULL;
+  }
+  H5Guard(H5Gclose (files[id]));
   
-  // set the id back to -1 to mark it free to be used again
   files[id] = -1;
 }
 
 
-void getDims(int id, int dims[2]) {
-  hsize_t dim[2];
 
-  hid_t dataset_id =  H5Guard(H5Dopen(files[id], "/step0", H5P_DEFAULT));
+// Return a free slot of the table of subfiled outputs, doubling its size if all are used.
+static int newSubfiles(void) {
+  int i = 0;
+  while(i < nbSubfiles && subfiles[i].file != -1) i++;
+  if(i == nbSubfiles) {
+    nbSubfiles = nbSubfiles ? 2 * nbSubfiles : 2;
+    subfiles = (subfiles_t*)realloc(subfiles, nbSubfiles * sizeof(subfiles_t));
+    for(int j = i; j < nbSubfiles; j++) {
+      subfiles[j].file = -1;
+    }
+  }
+  return i;
+}
+
 
-  hid_t dataspace_id = H5Guard(H5Dget_space(dataset_id));
-  H5Guard(H5Sget_simple_extent_dims(dataspace_id, dim, NULL));
+// Write the frames in one subfile per group of groupSize processes of the IO communicator (0 for a subfile per node, i.e. per
+// group of processes sharing memory), named after the file defined with (format, ...) followed by the rank of the first
+// process of the group, and in this file, the master file, a virtual dataset per frame presenting the subfiles as a whole.
+// The frames are read from the master file like any other, the subfiles must stay next to it.
+// The datasets of a subfile only cover the blocks of its processes; see writeDecimatedFrame for the other arguments.
+// Set append to 1 to add frames to existing files, written with the same processes.
+// Return an id to give to writeSubfiledFrame and closeSubfiles.
+int createSubfiles(int groupSize, int append, int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, const char* format, ...) {
+  // get the name of the master file
+  GET_NAME
 
-  H5Guard(H5Dclose(dataset_id));
+  int i = newSubfiles();
+  subfiles_t *sub = &subfiles[i];
+
+#if H5_VERSION_GE(1, 10, 0)
+  int rank;
+  MPI_Comm_rank(ioComm, &rank);
+  if( groupSize ) {
+    MPI_Comm_split(ioComm, rank / groupSize, rank, &sub->group);
+  } else {
+    MPI_Comm_split_type(ioComm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &sub->group);
+  }
+
+  // the subfile takes the rank of the first process of the group
+  int index = rank;
+  MPI_Bcast(&index, 1, MPI_INT, 0, sub->group);
+  MPI_Comm comm = ioComm;
+  ioComm = sub->group;
+  sub->file = append ? appendFile(1, "%s.%d", s, index) : createFile(1, "%s.%d", s, index);
+
+  // the block of the process in the frame, and the rectangle covering the blocks of the group
+  hsize_t memOffset[2], fileOffset[2], dataSize[2];
+  int empty = decimate(arrayDims, dataMargin, stride, fileXOffset, fileYOffset, memOffset, fileOffset, dataSize);
+  int lo[2] = {INT_MAX, INT_MAX}, hi[2] = {0, 0};
+  if( !empty ) {
+    lo[0] = fileOffset[0];
+    lo[1] = fileOffset[1];
+    hi[0] = fileOffset[0] + dataSize[0];
+    hi[1] = fileOffset[1] + dataSize[1];
+  }
+  MPI_Allreduce(MPI_IN_PLACE, lo, 2, MPI_INT, MPI_MIN, sub->group);
+  MPI_Allreduce(MPI_IN_PLACE, hi, 2, MPI_INT, MPI_MAX, sub->group);
+  hsize_t boxSize[2] = {lo[0] < hi[0] ? hi[0] - lo[0] : 0, lo[1] < hi[1] ? hi[1] - lo[1] : 0};
+
+  // the layout of the block in the frame, whose file dataspace is replaced by the rectangle of the group
+  sub->layout = createLayout(arrayDims, dataMargin, stride, fileDims, fileXOffset, fileYOffset, 1);
+  layout_t *layout = &layouts[sub->layout];
+  H5Guard(H5Sclose(layout->fdataspace));
+  layout->fdataspace = H5Guard(H5Screate_simple(2, boxSize, NULL));
+  if( empty ) {
+    H5Guard(H5Sselect_none(layout->fdataspace));
+  } else {
+    hsize_t boxOffset[2] = {fileOffset[0] - lo[0], fileOffset[1] - lo[1]};
+    H5Guard(H5Sselect_hyperslab(layout->fdataspace, H5S_SELECT_SET, boxOffset, NULL, dataSize, NULL));
+  }
+  if( layout->dcpl != H5P_DEFAULT ) {
+    H5Guard(H5Pclose(layout->dcpl));
+    layout->dcpl = H5P_DEFAULT;
+  }
+  if( frameChunk[0] && boxSize[0] && boxSize[1] ) {
+    hsize_t chunkSize[2] = {
+      frameChunk[0] < boxSize[0] ? frameChunk[0] : boxSize[0],
+      frameChunk[1] < boxSize[1] ? frameChunk[1] : boxSize[1]
+    };
+    layout->dcpl = frameDcpl(2, chunkSize);
+  }
+  ioComm = comm;
+
+  // the first process writes the master file alone, and maps the blocks of all processes to their subfiles
+  int size, block[SUBFILE_BLOCK] = {index, fileOffset[0], fileOffset[1], empty ? 0 : dataSize[0], empty ? 0 : dataSize[1], lo[0], lo[1], boxSize[0], boxSize[1]};
+  MPI_Comm_size(ioComm, &size);
+  sub->blocks = NULL;
+  sub->master = -1;
+  if( rank == 0 ) {
+    sub->blocks = malloc(size * sizeof(sub->blocks[0]));
+    sub->master = append ? appendFile(0, "%s", s) : createFile(0, "%s", s);
+  }
+  MPI_Gather(block, SUBFILE_BLOCK, MPI_INT, sub->blocks, SUBFILE_BLOCK, MPI_INT, 0, ioComm);
+  sub->nbBlocks = size;
+
+  // the virtual datasets refer to the subfiles by their names relative to the master file
+  const char *base = strrchr(s, '/');
+  strcpy(sub->name, base ? base + 1 : s);
+  sub->frameSize[0] = (fileDims[0] + stride - 1) / stride;
+  sub->frameSize[1] = (fileDims[1] + stride - 1) / stride;
+  sub->ftype = layout->ftype;
+#else
+  (void)groupSize; (void)append; (void)arrayDims; (void)dataMargin; (void)stride; (void)fileDims; (void)fileXOffset; (void)fileYOffset;
+  fprintf(stderr, "The subfiles of %s need the virtual datasets of HDF5 >= 1.10.\n", s);
+  MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
 
-  dims[0] = dim[0]; dims[1] = dim[1];
+  return i;
 }
 
-int createGroup(int id, const char* format, ...) {
-  // get the name of the file we're trying to open
+
+// Write a frame of the subfiled output defined by id, in the dataset which name is defined with (format, ...) using the same
+// syntax as printf: the block of the process in the subfile of its group, and the virtual dataset in the master file.
+void writeSubfiledFrame(int id, double *data, const char* format, ...) {
+  // get the name of the dataset we're writing in
   GET_NAME
 
-  // Check the array of ids to find an empty slot
-  for(int i = 0; i < MAX_FILE_NUM; i++) {
-    if(files[i] == -1) {
-      files[i] = H5Guard(H5Gcreate( files[id], s, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
-      return i;
-    }
+  subfiles_t *sub = &subfiles[id];
+  writeLayoutFrame(sub->layout, sub->file, data, "%s", s);
+
+#if H5_VERSION_GE(1, 10, 0)
+  if( sub->master < 0 ) {
+    return;
+  }
+  // a frame already in the master file, written before appendFile, is replaced, since its subfiled datasets may have had
+  // another stride or datatype
+  if( H5Guard(H5Lexists(files[sub->master], s, H5P_DEFAULT)) ) {
+    H5Guard(H5Ldelete(files[sub->master], s, H5P_DEFAULT));
   }
 
-  // No space left in the ids array to open a new file
-  fprintf(stderr, "Too much files or groups opened.\n");
-  MPI_Abort(MPI_COMM_WORLD, 1);
-  exit(1);
+  PROFILE_START(PROFILE_WRITE);
+  hid_t dcpl_id = H5Guard(H5Pcreate(H5P_DATASET_CREATE));
+  hid_t vspace_id = H5Guard(H5Screate_simple(2, sub->frameSize, NULL));
+  for(int b = 0; b < sub->nbBlocks; b++) {
+    int *block = sub->blocks[b];
+    if( !block[3] || !block[4] ) continue;
+
+    hsize_t offset[2] = {block[1], block[2]}, count[2] = {block[3], block[4]};
+    hsize_t boxOffset[2] = {block[1] - block[5], block[2] - block[6]}, boxSize[2] = {block[7], block[8]};
+    hid_t src_id = H5Guard(H5Screate_simple(2, boxSize, NULL));
+    H5Guard(H5Sselect_hyperslab(src_id, H5S_SELECT_SET, boxOffset, NULL, count, NULL));
+    H5Guard(H5Sselect_hyperslab(vspace_id, H5S_SELECT_SET, offset, NULL, count, NULL));
+
+    char subName[120];
+    snprintf(subName, sizeof(subName), "%s.%d", sub->name, block[0]);
+    H5Guard(H5Pset_virtual(dcpl_id, vspace_id, subName, s, src_id));
+    H5Guard(H5Sclose(src_id));
+  }
+
+  H5Guard(H5Sselect_all(vspace_id));
+  hid_t dataset_id = H5Guard(H5Dcreate(files[sub->master], s, sub->ftype, vspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT));
+  H5Guard(H5Dclose(dataset_id));
+  H5Guard(H5Sclose(vspace_id));
+  H5Guard(H5Pclose(dcpl_id));
+  PROFILE_STOP(PROFILE_WRITE, 0);
+#endif
 }
 
-void closeGroup(int id) {
-  H5Guard(H5Gclose (files[id]));
-  
-  files[id] = -1;
+
+// Close the subfiles and the master file of the subfiled output
+void closeSubfiles(int id) {
+  subfiles_t *sub = &subfiles[id];
+
+  closeLayout(sub->layout);
+  closeFile(sub->file, 1);
+  if( sub->master >= 0 ) {
+    closeFile(sub->master, 0);
+  }
+  MPI_Comm_free(&sub->group);
+  free(sub->blocks);
+
+  sub->file = -1;
 }
@@ -1,18 +1,66 @@
 #ifndef __HDF5IO__
 #define __HDF5IO__
 
+#include <mpi.h>
+
+void setIOComm(MPI_Comm comm);
+
 int createFile(int multiAccess, const char* format, ...);
 
 int openFile(int multiAccess, const char* format, ...);
 
+int appendFile(int multiAccess, const char* format, ...);
+
+void setCompression(int *chunkDims, int level, int shuffle);
+
+void setFrameType(int single);
+
+int createLayout(int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess);
+
+void writeLayoutFrame(int layout, int id, double *data, const char* format, ...);
+
+void readLayoutFrame(int layout, int id, double *data, const char* format, ...);
+
+void closeLayout(int layout);
+
 void writeFrame(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, const char* format, ...);
 
+void writeDecimatedFrame(int id, double *data, int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, const char* format, ...);
+
 void readFrame(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, const char* format, ...);
 
+void readStep(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, int step);
+
+void readSteps(int id, double *data, int *arrayDims, int dataMargin, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess, int nb, int *steps);
+
 void closeFile(int id, int multiAccess);
 
+void writeFrameDims(int id, int *fileDims, int stride);
+
 void getDims(int id, int dims[2]);
 
+int createSeries(int id, int *fileDims, int *chunkDims);
+
+int openSeries(int id, int step);
+
+void writeSeriesFrame(int id, int step, double *data, int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, int multiAccess);
+
+void writeSeriesBlock(int id, double *data, int *arrayDims, int dataMargin, int stride, int fileXOffset, int fileYOffset, int multiAccess);
+
+void closeSeries(int id);
+
+int createSubfiles(int groupSize, int append, int *arrayDims, int dataMargin, int stride, int *fileDims, int fileXOffset, int fileYOffset, const char* format, ...);
+
+void writeSubfiledFrame(int id, double *data, const char* format, ...);
+
+void closeSubfiles(int id);
+
+void writeIntArray(int id, int *values, int count, int multiAccess, const char* format, ...);
+
+void writeIntAttribute(int id, const char *object, const char *name, int value);
+
+int readIntAttribute(int id, const char *object, const char *name);
+
 int createGroup(int id, const char* format, ...);
 
 void closeGroup(int id);
@@ -1,18 +1,147 @@
 #include <mpi.h>
 
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <hdf5.h>
 #include "hdf5IO.h"
+#include "asyncWriter.h"
+#include "stencil.h"
+#include "decomp.h"
+#include "analysis.h"
+#include "transit.h"
+#include "profile.h"
+
+/// largest number of iterations of the conjugate gradients in an implicit step
+#define CG_MAX_ITER 10000
+
+/// value of options.subfiles for a file per node
+#define SUBFILES_NODE -1
+
+/// number of iterations between two tests of the clock of --checkpoint-time
+#define CHECKPOINT_TIME_EVERY 10
+
+struct insitu;
+
+/** A diagnostic computed on the data blocks held by the process, written in the group of the iteration
+ * @param[in]  diag   the description of the diagnostics output (struct insitu)
+ * @param[in]  prev   the data blocks at the previous iteration, NULL if they are not available
+ * @param[in]  cur	the data blocks at the iteration step
+ * @param	  step   the iteration
+ */
+typedef void (*insitu_hook)(struct insitu *diag, double **prev, double **cur, int step);
+
+/** The optional behaviours of the solver selected on the command line */
+struct options {
+  /// overlap the update of the ghost zones with the computation of the interior points
+  int overlap;
+  /// number of staging buffers of the asynchronous writer (0 to write in the time loop)
+  int async_depth;
+  /// write a frame every `every` iterations
+  int every;
+  /// if not NULL, write only the nb_steps frames listed in steps
+  int *steps;
+  int nb_steps;
+  /// write one point out of `stride` in each dimension
+  int stride;
+  /// write the frames in a single [time][y][x] dataset instead of a dataset per frame
+  int series;
+  /// store the frames in one chunk per local data block, compressed with this deflate level (0 for none)
+  int deflate;
+  /// apply the shuffle filter before compression
+  int shuffle;
+  /// use the cache blocked and vectorized stencil kernel instead of iter
+  int tiled;
+  /// height and width of the tiles of the tiled kernels (0 for the default of stencil.c)
+  int tile[2];
+  /// width of the ghost zones, they are updated every `halo` iterations
+  int halo;
+  /// write a checkpoint every `checkpoint_every` iterations (0 for never)
+  int checkpoint_every;
+  /// write a checkpoint when `checkpoint_time` seconds have elapsed since the previous one (0 for never)
+  double checkpoint_time;
+  /// continue from the last checkpoint instead of starting at t=0
+  int restart;
+  /// the nb_hooks diagnostics computed in the solver
+  insitu_hook hooks[2];
+  int nb_hooks;
+  /// compute the diagnostics every `insitu_every` iterations
+  int insitu_every;
+  /// whether a diagnostic needs the previous iteration
+  int insitu_prev;
+  /// number of processes dedicated to the frames and the diagnostics (0 to do them in the solver)
+  int transit;
+  /// number of frames in flight from a solver process to its analysis process
+  int transit_depth;
+  /// stop when the largest change of a point over an iteration is below `converge` (0 to run all the iterations)
+  double converge;
+  /// compute the change every `converge_every` iterations
+  int converge_every;
+  /// each iteration is an implicit (backward Euler) step as long as `implicit` explicit steps (0 for explicit iterations)
+  double implicit;
+  /// the conjugate gradients stop when the norm of the residual is reduced by `cg_tol`
+  double cg_tol;
+  /// store the frames in single precision
+  int store_single;
+  /// compute the iterations and exchange the ghost zones in single precision
+  int compute_single;
+  /// write the frames in a file per group of `subfiles` processes (SUBFILES_NODE for a file per node, 0 for a single file)
+  int subfiles;
+};
+
+/** Everything needed to write a frame of the local data block in the output file */
+struct output {
+  int fileId;
+  int dsize[2];
+  int fsize[2];
+  int offset[2];
+  /// width of the ghost zones, not written
+  int margin;
+  int stride;
+  /// the time series the frames are appended to, -1 to write a dataset per frame
+  int seriesId;
+  /// the layout of the datasets of the local data block in the file, when there is no time series
+  int layoutId;
+  /// the subfiles the frames are written to, -1 to write them in heat.h5 itself
+  int subfilesId;
+};
+
+/** Everything needed to compute and write the diagnostics of the data blocks held by the process in diags.h5:
+ * the local data block in the solver, or the blocks received from the solver processes in transit */
+struct insitu {
+  int fileId;
+  /// the group of the iteration analyzed
+  int groupId;
+  int fsize[2];
+  /// size (including ghost zones) and position in the whole problem of the nb_blocks data blocks
+  int nb_blocks;
+  int (*dsize)[2];
+  int (*offset)[2];
+  /// width of the ghost zones, not analyzed
+  int margin;
+  /// the processes sharing diags.h5
+  MPI_Comm comm;
+  /// the processes sharing the rows, the columns of the local data block of a solver process,
+  /// MPI_COMM_NULL on the analysis processes
+  MPI_Comm row_comm;
+  MPI_Comm col_comm;
+  /// work arrays: a value per row and per column of the local data block (of the whole problem on the analysis
+  /// processes), and per point of the largest data block
+  double *rows;
+  double *cols;
+  double *points;
+};
 
 /** A function to initialize the temperature at t=0
  * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  halo   width of the ghost zones
  * @param	  pcoord position of the local data block in the array of data blocks
  * @param[out] dat	the local data block to initialize
  */
-void init(int dsize[2], int pcoord[2], double dat[dsize[0]][dsize[1]])
+void init(int dsize[2], int halo, int pcoord[2], double dat[dsize[0]][dsize[1]])
 {
   // initialize everything to 0
   for (int yy=0; yy<dsize[0]; ++yy) {
@@ -23,7 +152,9 @@ void init(int dsize[2], int pcoord[2], double dat[dsize[0]][dsize[1]])
   // except the boundary condition at x=0 if our block is at the boundary itself
   if ( pcoord[1] == 0 ) {
     for (int yy=0; yy<dsize[0]; ++yy) {
-      dat[yy][0] = 1000000;
+      for (int xx=0; xx<halo; ++xx) {
+        dat[yy][xx] = 1000000;
+      }
     }
   }
 }
@@ -33,14 +164,18 @@ void init(int dsize[2], int pcoord[2], double dat[dsize[0]][dsize[1]])
  * @param	  pcoord position of the local data block in the array of data blocks
  * @param[in]  cur	the current value (t) of the local data block
  * @param[out] next   the next value (t+delta_t) of the local data block
+ * @param[out] change if not NULL, the largest change of a point of the local data block, computed in the same pass
  */
-void iter(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+void iter(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]], double *change)
 {
   int xx, yy;
+  double delta = 0;
   // copy the boundary values at x=0 (Dirichlet boundary condition)
   for (xx=0; xx<dsize[1]; ++xx) {
     next[0][xx] = cur[0][xx];
   }
+  // rows are shared between the threads of the process
+  #pragma omp parallel for private(xx) reduction(max:delta)
   for (yy=1; yy<dsize[0]-1; ++yy) {
     // copy the boundary values at y=0 (Dirichlet boundary condition)
     next[yy][0] = cur[yy][0];
@@ -51,6 +186,7 @@ void iter(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][ds
         + (cur[yy][xx+1] *.125)
         + (cur[yy-1][xx] *.125)
         + (cur[yy+1][xx] *.125);
+      if ( change ) delta = fmax(delta, fabs(next[yy][xx]-cur[yy][xx]));
     }
     // copy the boundary values at y=YMAX (Dirichlet boundary condition)
     next[yy][dsize[1]-1] = cur[yy][dsize[1]-1];
@@ -59,6 +195,197 @@ void iter(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][ds
   for (xx=0; xx<dsize[1]; ++xx) {
     next[dsize[0]-1][xx] = cur[dsize[0]-1][xx];
   }
+  if ( change ) *change = delta;
+}
+
+/** A function to compute the largest change of a point of the local data block between two iterations,
+ * for the kernels that do not compute it themselves
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  halo   width of the ghost zones, not included
+ * @param[in]  prev   the local data block at the previous iteration
+ * @param[in]  cur	the local data block at the current iteration
+ * @return	 the largest absolute difference between prev and cur
+ */
+double block_change(int dsize[2], int halo, double prev[dsize[0]][dsize[1]], double cur[dsize[0]][dsize[1]])
+{
+  double delta = 0;
+  #pragma omp parallel for reduction(max:delta)
+  for (int yy=halo; yy<dsize[0]-halo; ++yy) {
+    for (int xx=halo; xx<dsize[1]-halo; ++xx) {
+      delta = fmax(delta, fabs(cur[yy][xx]-prev[yy][xx]));
+    }
+  }
+  return delta;
+}
+
+/** A function to compute the temperature at t+delta_t on a rectangle of the local data block
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  ymin, ymax first and past-the-last rows of the rectangle
+ * @param	  xmin, xmax first and past-the-last columns of the rectangle
+ * @param[in]  cur	the current value (t) of the local data block
+ * @param[out] next   the next value (t+delta_t) of the local data block
+ */
+void iter_rect(int dsize[2], int ymin, int ymax, int xmin, int xmax, double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+{
+  #pragma omp parallel for
+  for (int yy=ymin; yy<ymax; ++yy) {
+    for (int xx=xmin; xx<xmax; ++xx) {
+      next[yy][xx] =
+        (cur[yy][xx]   *.5)
+        + (cur[yy][xx-1] *.125)
+        + (cur[yy][xx+1] *.125)
+        + (cur[yy-1][xx] *.125)
+        + (cur[yy+1][xx] *.125);
+    }
+  }
+}
+
+/** A function to copy the boundary values (Dirichlet boundary condition), i.e. the ghost zones
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param[in]  cur	the current value (t) of the local data block
+ * @param[out] next   the next value (t+delta_t) of the local data block
+ */
+void copy_boundary(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+{
+  for (int xx=0; xx<dsize[1]; ++xx) {
+    next[0][xx] = cur[0][xx];
+    next[dsize[0]-1][xx] = cur[dsize[0]-1][xx];
+  }
+  for (int yy=1; yy<dsize[0]-1; ++yy) {
+    next[yy][0] = cur[yy][0];
+    next[yy][dsize[1]-1] = cur[yy][dsize[1]-1];
+  }
+}
+
+/** A function to compute the temperature at t+delta_t with the cache blocked and vectorized kernel,
+ * the values are the same as the ones of iter
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param[in]  cur	the current value (t) of the local data block
+ * @param[out] next   the next value (t+delta_t) of the local data block
+ */
+void iter_tiled(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+{
+  copy_boundary(dsize, cur, next);
+  stencilTiled(dsize[1], &cur[0][0], &next[0][0], 1, dsize[0]-1, 1, dsize[1]-1);
+}
+
+/** A function to compute the temperature at t+delta_t in single precision
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  tiled  use the cache blocked kernel of stencil.c instead of the loop of iter
+ * @param[in]  cur	the current value (t) of the local data block
+ * @param[out] next   the next value (t+delta_t) of the local data block
+ */
+void iter_single(int dsize[2], int tiled, float cur[dsize[0]][dsize[1]], float next[dsize[0]][dsize[1]])
+{
+  // copy the boundary values (Dirichlet boundary condition)
+  for (int xx=0; xx<dsize[1]; ++xx) {
+    next[0][xx] = cur[0][xx];
+    next[dsize[0]-1][xx] = cur[dsize[0]-1][xx];
+  }
+  for (int yy=1; yy<dsize[0]-1; ++yy) {
+    next[yy][0] = cur[yy][0];
+    next[yy][dsize[1]-1] = cur[yy][dsize[1]-1];
+  }
+  if ( tiled ) {
+    stencilTiledSingle(dsize[1], &cur[0][0], &next[0][0], 1, dsize[0]-1, 1, dsize[1]-1);
+    return;
+  }
+  #pragma omp parallel for
+  for (int yy=1; yy<dsize[0]-1; ++yy) {
+    for (int xx=1; xx<dsize[1]-1; ++xx) {
+      next[yy][xx] =
+        (cur[yy][xx]   *.5f)
+        + (cur[yy][xx-1] *.125f)
+        + (cur[yy][xx+1] *.125f)
+        + (cur[yy-1][xx] *.125f)
+        + (cur[yy+1][xx] *.125f);
+    }
+  }
+}
+
+/** A function to convert a local data block from single to double precision
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param[in]  src	the local data block in single precision
+ * @param[out] dst	the local data block in double precision
+ */
+void to_double(int dsize[2], float src[dsize[0]][dsize[1]], double dst[dsize[0]][dsize[1]])
+{
+  #pragma omp parallel for
+  for (int yy=0; yy<dsize[0]; ++yy) {
+    for (int xx=0; xx<dsize[1]; ++xx) {
+      dst[yy][xx] = src[yy][xx];
+    }
+  }
+}
+
+/** A function to convert a local data block from double to single precision
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param[in]  src	the local data block in double precision
+ * @param[out] dst	the local data block in single precision
+ */
+void to_single(int dsize[2], double src[dsize[0]][dsize[1]], float dst[dsize[0]][dsize[1]])
+{
+  #pragma omp parallel for
+  for (int yy=0; yy<dsize[0]; ++yy) {
+    for (int xx=0; xx<dsize[1]; ++xx) {
+      dst[yy][xx] = src[yy][xx];
+    }
+  }
+}
+
+/** A function to compute the points of the local data block that do not depend on the ghost zones
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param[in]  cur	the current value (t) of the local data block
+ * @param[out] next   the next value (t+delta_t) of the local data block
+ */
+void iter_interior(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+{
+  iter_rect(dsize, 2, dsize[0]-2, 2, dsize[1]-2, cur, next);
+}
+
+/** A function to compute the one point wide border strip of the local data block, i.e. the points
+ * that depend on the ghost zones, and to copy the boundary values. Together with iter_interior it
+ * computes the same values as iter.
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param[in]  cur	the current value (t) of the local data block
+ * @param[out] next   the next value (t+delta_t) of the local data block
+ */
+void iter_border(int dsize[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+{
+  copy_boundary(dsize, cur, next);
+  // first and last rows
+  iter_rect(dsize, 1, 2, 1, dsize[1]-1, cur, next);
+  iter_rect(dsize, dsize[0]-2, dsize[0]-1, 1, dsize[1]-1, cur, next);
+  // first and last columns, without the rows already computed
+  iter_rect(dsize, 2, dsize[0]-2, 1, 2, cur, next);
+  iter_rect(dsize, 2, dsize[0]-2, dsize[1]-2, dsize[1]-1, cur, next);
+}
+
+/** A function to get the MPI datatypes used to exchange the ghost zones
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  elem   the datatype of the points, MPI_DOUBLE or MPI_FLOAT
+ * @param[out] column a column of the local data block, without the ghost zones
+ * @param[out] row	a row of the local data block, without the ghost zones
+ */
+void halo_types(int dsize[2], MPI_Datatype elem, MPI_Datatype *column, MPI_Datatype *row)
+{
+  static MPI_Datatype s_column[2], s_row[2];
+  static int initialized[2] = { 0, 0 };
+  int single = elem == MPI_FLOAT;
+
+  // Build the MPI datatypes if this is the first time this function is called for this datatype
+  if ( !initialized[single] ) {
+    // A vector column when exchanging width neighbours on left/right
+    MPI_Type_vector(dsize[0]-2, 1, dsize[1], elem, &s_column[single]);
+    MPI_Type_commit(&s_column[single]);
+    // A row column when exchanging width neighbours on top/down
+    MPI_Type_contiguous(dsize[1]-2, elem, &s_row[single]);
+    MPI_Type_commit(&s_row[single]);
+    initialized[single] = 1;
+  }
+
+  *column = s_column[single];
+  *row = s_row[single];
 }
 
 /** A function to update the values of the ghost zones
@@ -70,19 +397,8 @@ void exchange(MPI_Comm cart_comm, int dsize[2], double cur[dsize[0]][dsize[1]])
 {
   MPI_Status status;
   int rank_source, rank_dest;
-  static MPI_Datatype column, row;
-  static int initialized = 0;
-
-  // Build the MPI datatypes if this is the first time this function is called
-  if ( !initialized ) {
-    // A vector column when exchanging width neighbours on left/right
-    MPI_Type_vector(dsize[0]-2, 1, dsize[1], MPI_DOUBLE, &column);
-    MPI_Type_commit(&column);
-    // A row column when exchanging width neighbours on top/down
-    MPI_Type_contiguous(dsize[1]-2, MPI_DOUBLE, &row);
-    MPI_Type_commit(&row);
-    initialized = 1;
-  }
+  MPI_Datatype column, row;
+  halo_types(dsize, MPI_DOUBLE, &column, &row);
 
   // send to the bottom, receive from the top
   MPI_Cart_shift(cart_comm, 0, 1, &rank_source, &rank_dest);
@@ -109,89 +425,1341 @@ void exchange(MPI_Comm cart_comm, int dsize[2], double cur[dsize[0]][dsize[1]])
       cart_comm, &status);
 }
 
+/** A function to update the values of the ghost zones of a local data block in single precision, see exchange
+ * @param	  cart_comm a MPI Cartesian communicator including all processes arranged in grid
+ * @param	  dsize	 size of the local data block (including ghost zones)
+ * @param[out] cur	   the local data block whose ghost zones are updated
+ */
+void exchange_single(MPI_Comm cart_comm, int dsize[2], float cur[dsize[0]][dsize[1]])
+{
+  int rank_source, rank_dest;
+  MPI_Datatype column, row;
+  halo_types(dsize, MPI_FLOAT, &column, &row);
+
+  // send to the bottom, receive from the top
+  MPI_Cart_shift(cart_comm, 0, 1, &rank_source, &rank_dest);
+  MPI_Sendrecv(&cur[dsize[0]-2][1], 1, row, rank_dest, 100, &cur[0][1], 1, row, rank_source, 100, cart_comm, MPI_STATUS_IGNORE);
+
+  // send to the top, receive from the bottom
+  MPI_Cart_shift(cart_comm, 0, -1, &rank_source, &rank_dest);
+  MPI_Sendrecv(&cur[1][1], 1, row, rank_dest, 100, &cur[dsize[0]-1][1], 1, row, rank_source, 100, cart_comm, MPI_STATUS_IGNORE);
+
+  // send to the right, receive from the left
+  MPI_Cart_shift(cart_comm, 1, 1, &rank_source, &rank_dest);
+  MPI_Sendrecv(&cur[1][dsize[1]-2], 1, column, rank_dest, 100, &cur[1][0], 1, column, rank_source, 100, cart_comm, MPI_STATUS_IGNORE);
+
+  // send to the left, receive from the right
+  MPI_Cart_shift(cart_comm, 1, -1, &rank_source, &rank_dest);
+  MPI_Sendrecv(&cur[1][1], 1, column, rank_dest, 100, &cur[1][dsize[1]-1], 1, column, rank_source, 100, cart_comm, MPI_STATUS_IGNORE);
+}
+
+/** A function to start the update of the values of the ghost zones without waiting for the
+ * messages, so that the points that do not depend on the ghost zones can be computed meanwhile
+ * @param	  cart_comm a MPI Cartesian communicator including all processes arranged in grid
+ * @param	  dsize	 size of the local data block (including ghost zones)
+ * @param[out] cur	   the local data block whose ghost zones are updated
+ * @param[out] reqs	  the requests to complete with exchange_end
+ */
+void exchange_begin(MPI_Comm cart_comm, int dsize[2], double cur[dsize[0]][dsize[1]], MPI_Request reqs[8])
+{
+  int rank_up, rank_down, rank_left, rank_right;
+  MPI_Datatype column, row;
+  halo_types(dsize, MPI_DOUBLE, &column, &row);
+
+  MPI_Cart_shift(cart_comm, 0, 1, &rank_up, &rank_down);
+  MPI_Cart_shift(cart_comm, 1, 1, &rank_left, &rank_right);
+
+  // post the receptions in the ghost zones first
+  MPI_Irecv(&cur[0][1],          1, row,    rank_up,    100, cart_comm, &reqs[0]);
+  MPI_Irecv(&cur[dsize[0]-1][1], 1, row,    rank_down,  101, cart_comm, &reqs[1]);
+  MPI_Irecv(&cur[1][0],          1, column, rank_left,  102, cart_comm, &reqs[2]);
+  MPI_Irecv(&cur[1][dsize[1]-1], 1, column, rank_right, 103, cart_comm, &reqs[3]);
+
+  // then send the rows and columns next to the ghost zones
+  MPI_Isend(&cur[dsize[0]-2][1], 1, row,    rank_down,  100, cart_comm, &reqs[4]);
+  MPI_Isend(&cur[1][1],          1, row,    rank_up,    101, cart_comm, &reqs[5]);
+  MPI_Isend(&cur[1][dsize[1]-2], 1, column, rank_right, 102, cart_comm, &reqs[6]);
+  MPI_Isend(&cur[1][1],          1, column, rank_left,  103, cart_comm, &reqs[7]);
+}
+
+/** A function to wait for the end of the update of the ghost zones started with exchange_begin
+ * @param	  reqs	  the requests returned by exchange_begin
+ */
+void exchange_end(MPI_Request reqs[8])
+{
+  MPI_Waitall(8, reqs, MPI_STATUSES_IGNORE);
+}
+
+/** A function to apply the operator of the implicit step, (1+4c) u - c (sum of the 4 neighbours), to the
+ * points of the local data block, the ghost zones of in being up to date
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  c	  the time step in units of the space step squared divided by the diffusivity
+ * @param[in]  in	 the local data block the operator is applied to
+ * @param[out] out	the result, the ghost zones are not computed
+ */
+void apply_implicit(int dsize[2], double c, double in[dsize[0]][dsize[1]], double out[dsize[0]][dsize[1]])
+{
+  #pragma omp parallel for
+  for (int yy=1; yy<dsize[0]-1; ++yy) {
+    for (int xx=1; xx<dsize[1]-1; ++xx) {
+      out[yy][xx] = (1+4*c)*in[yy][xx]
+        - c*(in[yy][xx-1] + in[yy][xx+1] + in[yy-1][xx] + in[yy+1][xx]);
+    }
+  }
+}
+
+/** A function to compute the scalar product of two local data blocks over all the processes
+ * @param	  cart_comm a MPI Cartesian communicator including all processes arranged in grid
+ * @param	  dsize	 size of the local data block (including ghost zones)
+ * @param[in]  aa, bb	the local data blocks, their ghost zones are not included
+ * @return	 the scalar product of the whole problem
+ */
+double dot_product(MPI_Comm cart_comm, int dsize[2], double aa[dsize[0]][dsize[1]], double bb[dsize[0]][dsize[1]])
+{
+  double sum = 0;
+  #pragma omp parallel for reduction(+:sum)
+  for (int yy=1; yy<dsize[0]-1; ++yy) {
+    for (int xx=1; xx<dsize[1]-1; ++xx) {
+      sum += aa[yy][xx]*bb[yy][xx];
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, cart_comm);
+  return sum;
+}
+
+/** A function to compute the temperature after an implicit (backward Euler) step, solving
+ * (1+4c) next - c (sum of the 4 neighbours of next) = cur with the conjugate gradients preconditioned by
+ * the diagonal (Jacobi). The explicit iteration is the forward Euler step with c = 1/8.
+ * @param	  cart_comm a MPI Cartesian communicator including all processes arranged in grid
+ * @param	  dsize	 size of the local data block (including ghost zones of 1 point)
+ * @param[in]  opts	  the length of the step and the tolerance selected on the command line
+ * @param[in]  cur	   the current value (t) of the local data block, with its ghost zones up to date
+ * @param[out] next	  the value at t+opts->implicit*delta_t, with its ghost zones up to date
+ * @param	  work	  3 blocks of the size of the local data block, whose ghost zones on the
+ *					  boundaries of the problem are 0
+ * @return	 the number of iterations of the conjugate gradients
+ */
+int implicit_step(MPI_Comm cart_comm, int dsize[2], struct options *opts, double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]], double *work[3])
+{
+  double (*res)[dsize[1]] = (void*)work[0], (*dir)[dsize[1]] = (void*)work[1], (*prod)[dsize[1]] = (void*)work[2];
+  double cc = opts->implicit/8, diag = 1+4*cc;
+
+  // start from the current values, including the boundary values of the ghost zones
+  PROFILE_START(PROFILE_ITER);
+  memcpy(next, cur, sizeof(double)*dsize[0]*dsize[1]);
+  apply_implicit(dsize, cc, cur, prod);
+  #pragma omp parallel for
+  for (int yy=1; yy<dsize[0]-1; ++yy) {
+    for (int xx=1; xx<dsize[1]-1; ++xx) {
+      res[yy][xx] = cur[yy][xx]-prod[yy][xx];
+      dir[yy][xx] = res[yy][xx]/diag;
+    }
+  }
+  PROFILE_STOP(PROFILE_ITER, 0);
+
+  // with a constant diagonal, the preconditioned residual is res/diag
+  PROFILE_START(PROFILE_EXCHANGE);
+  double rr = dot_product(cart_comm, dsize, res, res), rr0 = rr;
+  PROFILE_STOP(PROFILE_EXCHANGE, 0);
+  int it = 0;
+  while ( rr > opts->cg_tol*opts->cg_tol*rr0 && it < CG_MAX_ITER ) {
+    // the direction is 0 on the boundaries, its other ghost zones are received from the neighbours
+    PROFILE_START(PROFILE_EXCHANGE);
+    exchange(cart_comm, dsize, dir);
+    PROFILE_STOP(PROFILE_EXCHANGE, 0);
+    PROFILE_START(PROFILE_ITER);
+    apply_implicit(dsize, cc, dir, prod);
+    PROFILE_STOP(PROFILE_ITER, 0);
+    PROFILE_START(PROFILE_EXCHANGE);
+    double alpha = rr/diag/dot_product(cart_comm, dsize, dir, prod);
+    PROFILE_STOP(PROFILE_EXCHANGE, 0);
+
+    PROFILE_START(PROFILE_ITER);
+    double rr_next = 0;
+    #pragma omp parallel for reduction(+:rr_next)
+    for (int yy=1; yy<dsize[0]-1; ++yy) {
+      for (int xx=1; xx<dsize[1]-1; ++xx) {
+        next[yy][xx] += alpha*dir[yy][xx];
+        res[yy][xx] -= alpha*prod[yy][xx];
+        rr_next += res[yy][xx]*res[yy][xx];
+      }
+    }
+    PROFILE_STOP(PROFILE_ITER, 0);
+    PROFILE_START(PROFILE_EXCHANGE);
+    MPI_Allreduce(MPI_IN_PLACE, &rr_next, 1, MPI_DOUBLE, MPI_SUM, cart_comm);
+    PROFILE_STOP(PROFILE_EXCHANGE, 0);
+
+    PROFILE_START(PROFILE_ITER);
+    double beta = rr_next/rr;
+    #pragma omp parallel for
+    for (int yy=1; yy<dsize[0]-1; ++yy) {
+      for (int xx=1; xx<dsize[1]-1; ++xx) {
+        dir[yy][xx] = res[yy][xx]/diag + beta*dir[yy][xx];
+      }
+    }
+    PROFILE_STOP(PROFILE_ITER, 0);
+    rr = rr_next;
+    ++it;
+  }
+
+  if ( it == CG_MAX_ITER ) {
+    int rank; MPI_Comm_rank(cart_comm, &rank);
+    if ( rank == 0 ) {
+      fprintf(stderr, "Warning: the conjugate gradients did not converge in %d iterations\n", CG_MAX_ITER);
+    }
+  }
+
+  PROFILE_START(PROFILE_EXCHANGE);
+  exchange(cart_comm, dsize, next);
+  PROFILE_STOP(PROFILE_EXCHANGE, 0);
+  return it;
+}
+
+/** A function to decide whether a frame is written
+ * @param[in]  opts   the output cadence selected on the command line
+ * @param	  step   the iteration
+ * @return	 1 if the frame of this iteration is written, 0 otherwise
+ */
+int is_output_step(struct options *opts, int step)
+{
+  if ( opts->steps ) {
+    for (int ii=0; ii<opts->nb_steps; ++ii) {
+      if ( opts->steps[ii] == step ) return 1;
+    }
+    return 0;
+  }
+  return step % opts->every == 0;
+}
+
+/** A function to decide whether the diagnostics are computed
+ * @param[in]  opts   the diagnostics selected on the command line
+ * @param	  step   the iteration
+ * @return	 1 if the diagnostics of this iteration are computed, 0 otherwise
+ */
+int is_insitu_step(struct options *opts, int step)
+{
+  return opts->nb_hooks && step % opts->insitu_every == 0;
+}
+
+/** A function to decide whether the change of the local data block is computed and reduced
+ * @param[in]  opts   the convergence criterion selected on the command line
+ * @param	  step   the iteration
+ * @return	 1 if the change between the iterations step-1 and step is computed, 0 otherwise
+ */
+int is_converge_step(struct options *opts, int step)
+{
+  return opts->converge > 0 && step % opts->converge_every == 0;
+}
+
+/** A function to decide whether an iteration is computed separately from the next ones, because its
+ * frame, its diagnostics or its change are needed
+ * @param[in]  opts   the optional behaviours selected on the command line
+ * @param	  step   the iteration
+ * @return	 1 if the local data block of this iteration is needed, 0 otherwise
+ */
+int is_needed_step(struct options *opts, int step)
+{
+  return is_output_step(opts, step) || is_insitu_step(opts, step) || (opts->insitu_prev && is_insitu_step(opts, step+1))
+    || is_converge_step(opts, step) || is_converge_step(opts, step+1);
+}
+
+/** A function to start the update of ghost zones of several points, including the corners
+ * received from the diagonal neighbours, without waiting for the messages
+ * @param	  cart_comm a MPI Cartesian communicator including all processes arranged in grid
+ * @param	  dsize	 size of the local data block (including ghost zones)
+ * @param	  halo	  width of the ghost zones
+ * @param[out] cur	   the local data block whose ghost zones are updated
+ * @param[out] reqs	  the requests to complete with MPI_Waitall
+ */
+void exchange_deep_begin(MPI_Comm cart_comm, int dsize[2], int halo, double cur[dsize[0]][dsize[1]], MPI_Request reqs[16])
+{
+  static MPI_Datatype row, column, corner;
+  static int initialized = 0;
+
+  // Build the MPI datatypes if this is the first time this function is called
+  if ( !initialized ) {
+    // halo rows, halo columns and the halo x halo corners of the local data block, without the ghost zones
+    MPI_Type_vector(halo, dsize[1]-2*halo, dsize[1], MPI_DOUBLE, &row);
+    MPI_Type_commit(&row);
+    MPI_Type_vector(dsize[0]-2*halo, halo, dsize[1], MPI_DOUBLE, &column);
+    MPI_Type_commit(&column);
+    MPI_Type_vector(halo, halo, dsize[1], MPI_DOUBLE, &corner);
+    MPI_Type_commit(&corner);
+    initialized = 1;
+  }
+
+  int psize[2], periods[2], pcoord[2];
+  MPI_Cart_get(cart_comm, 2, psize, periods, pcoord);
+
+  int nreq = 0;
+  for (int dy=-1; dy<=1; ++dy) {
+    for (int dx=-1; dx<=1; ++dx) {
+      if ( !dy && !dx ) continue;
+
+      // the neighbour in the direction (dy, dx), if any
+      int ncoord[2] = { pcoord[0]+dy, pcoord[1]+dx };
+      int neighbour = MPI_PROC_NULL;
+      if ( ncoord[0]>=0 && ncoord[0]<psize[0] && ncoord[1]>=0 && ncoord[1]<psize[1] ) {
+        MPI_Cart_rank(cart_comm, ncoord, &neighbour);
+      }
+      MPI_Datatype type = dy ? (dx ? corner : row) : column;
+
+      // first point of the ghost zone received from the neighbour, and of the points sent to it
+      int ry = dy<0 ? 0    : dy>0 ? dsize[0]-halo   : halo;
+      int rx = dx<0 ? 0    : dx>0 ? dsize[1]-halo   : halo;
+      int sy = dy<0 ? halo : dy>0 ? dsize[0]-2*halo : halo;
+      int sx = dx<0 ? halo : dx>0 ? dsize[1]-2*halo : halo;
+
+      // the tag is the direction the message travels in
+      MPI_Irecv(&cur[ry][rx], 1, type, neighbour, 200 + (1-dy)*3 + (1-dx), cart_comm, &reqs[nreq++]);
+      MPI_Isend(&cur[sy][sx], 1, type, neighbour, 200 + (1+dy)*3 + (1+dx), cart_comm, &reqs[nreq++]);
+    }
+  }
+}
+
+/** A function to compute the rectangle of the local data block where the ghost zones are valid
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  halo   width of the ghost zones
+ * @param	  fixed  whether each side (top, bottom, left, right) is a boundary of the problem
+ * @param	  grow   number of points of the ghost zones included, on the sides that are not a
+ *                   boundary of the problem (negative to exclude points of the local data block)
+ * @param[out] lo	 first row and column of the rectangle
+ * @param[out] hi	 past-the-last row and column of the rectangle
+ */
+void halo_region(int dsize[2], int halo, int fixed[4], int grow, int lo[2], int hi[2])
+{
+  lo[0] = halo          - (fixed[0] ? 0 : grow);
+  hi[0] = dsize[0]-halo + (fixed[1] ? 0 : grow);
+  lo[1] = halo          - (fixed[2] ? 0 : grow);
+  hi[1] = dsize[1]-halo + (fixed[3] ? 0 : grow);
+}
+
+/** A function to compute the temperature at t+delta_t on a rectangle with the selected kernel
+ * @param[in]  opts   the kernel selected on the command line
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  lo, hi the rectangle, see halo_region
+ * @param[in]  cur	the current value (t) of the local data block
+ * @param[out] next   the next value (t+delta_t) of the local data block
+ */
+void compute_rect(struct options *opts, int dsize[2], int lo[2], int hi[2], double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+{
+  if ( lo[0]>=hi[0] || lo[1]>=hi[1] ) return;
+  if ( opts->tiled ) {
+    stencilTiled(dsize[1], &cur[0][0], &next[0][0], lo[0], hi[0], lo[1], hi[1]);
+  } else {
+    iter_rect(dsize, lo[0], hi[0], lo[1], hi[1], cur, next);
+  }
+}
+
+/** A function to advance the local data block when the ghost zones are several points wide. The
+ * ghost zones are exchanged once every opts->halo iterations; in between, each iteration computes
+ * the part of the ghost zones still needed by the next ones, so that no message is required.
+ * With the tiled kernel, the iterations whose frame or diagnostics are not needed are computed at
+ * once with temporal blocking.
+ * @param	  cart_comm a MPI Cartesian communicator including all processes arranged in grid
+ * @param	  dsize	 size of the local data block (including ghost zones)
+ * @param[in]  opts	  the optional behaviours selected on the command line
+ * @param	  fixed	 whether each side (top, bottom, left, right) is a boundary of the problem
+ * @param[in,out] valid   number of points of the ghost zones that are up to date
+ * @param	  ii		the current iteration
+ * @param	  nb_iter   number of iterations to execute
+ * @param[in]  cur	   the current value (t) of the local data block
+ * @param[out] next	  the value of the local data block after the iterations computed
+ * @return	 the number of iterations computed
+ */
+int iter_deep(MPI_Comm cart_comm, int dsize[2], struct options *opts, int fixed[4], int *valid, int ii, int nb_iter, double cur[dsize[0]][dsize[1]], double next[dsize[0]][dsize[1]])
+{
+  int halo = opts->halo, lo[2], hi[2];
+
+  if ( *valid == 0 ) {
+    // number of iterations computed at once: none of them but the last one is needed
+    int nsteps = 1;
+    while ( opts->tiled && nsteps<halo && ii+nsteps<nb_iter && !is_needed_step(opts, ii+nsteps) ) {
+      ++nsteps;
+    }
+
+    MPI_Request reqs[16];
+    PROFILE_START(PROFILE_EXCHANGE);
+    exchange_deep_begin(cart_comm, dsize, halo, cur, reqs);
+    PROFILE_STOP(PROFILE_EXCHANGE, 0);
+
+    if ( nsteps > 1 ) {
+      PROFILE_START(PROFILE_EXCHANGE);
+      MPI_Waitall(16, reqs, MPI_STATUSES_IGNORE);
+      PROFILE_STOP(PROFILE_EXCHANGE, 0);
+      PROFILE_START(PROFILE_ITER);
+      halo_region(dsize, halo, fixed, 0, lo, hi);
+      stencilTemporal(dsize[0], dsize[1], &cur[0][0], &next[0][0], lo, hi, fixed, nsteps);
+      PROFILE_STOP(PROFILE_ITER, 0);
+      // the ghost zones of next are not computed
+      return nsteps;
+    }
+
+    if ( opts->overlap ) {
+      // compute the points that do not need the ghost zones while the messages are in flight
+      int ilo[2], ihi[2];
+      PROFILE_START(PROFILE_ITER);
+      halo_region(dsize, halo, fixed, -1, ilo, ihi);
+      compute_rect(opts, dsize, ilo, ihi, cur, next);
+      PROFILE_STOP(PROFILE_ITER, 0);
+      PROFILE_START(PROFILE_EXCHANGE);
+      MPI_Waitall(16, reqs, MPI_STATUSES_IGNORE);
+      PROFILE_STOP(PROFILE_EXCHANGE, 0);
+
+      // then the frame around them
+      PROFILE_START(PROFILE_ITER);
+      halo_region(dsize, halo, fixed, halo-1, lo, hi);
+      if ( ilo[0]>=ihi[0] || ilo[1]>=ihi[1] ) {
+        compute_rect(opts, dsize, lo, hi, cur, next);
+      } else {
+        int top[2][2]    = { { lo[0],  lo[1] },  { ilo[0], hi[1] } };
+        int bottom[2][2] = { { ihi[0], lo[1] },  { hi[0],  hi[1] } };
+        int left[2][2]   = { { ilo[0], lo[1] },  { ihi[0], ilo[1] } };
+        int right[2][2]  = { { ilo[0], ihi[1] }, { ihi[0], hi[1] } };
+        compute_rect(opts, dsize, top[0], top[1], cur, next);
+        compute_rect(opts, dsize, bottom[0], bottom[1], cur, next);
+        compute_rect(opts, dsize, left[0], left[1], cur, next);
+        compute_rect(opts, dsize, right[0], right[1], cur, next);
+      }
+      PROFILE_STOP(PROFILE_ITER, 0);
+      *valid = halo-1;
+      return 1;
+    }
+
+    PROFILE_START(PROFILE_EXCHANGE);
+    MPI_Waitall(16, reqs, MPI_STATUSES_IGNORE);
+    PROFILE_STOP(PROFILE_EXCHANGE, 0);
+    *valid = halo;
+  }
+
+  // the points of the ghost zones computed now are valid at the next iteration
+  PROFILE_START(PROFILE_ITER);
+  halo_region(dsize, halo, fixed, *valid-1, lo, hi);
+  compute_rect(opts, dsize, lo, hi, cur, next);
+  PROFILE_STOP(PROFILE_ITER, 0);
+  --*valid;
+  return 1;
+}
+
+/** A function to compute the means of the blocks of an analysis process: they are not aligned on a grid,
+ * so the sums of the rows and the columns of the whole problem are reduced on the first analysis process
+ * @param[in]  diag   the description of the diagnostics output
+ * @param[in]  cur	the data blocks at the iteration step
+ */
+void insitu_mean_transit(struct insitu *diag, double **cur)
+{
+  double total = 0;
+  memset(diag->rows, 0, sizeof(double)*diag->fsize[0]);
+  memset(diag->cols, 0, sizeof(double)*diag->fsize[1]);
+  for (int bb=0; bb<diag->nb_blocks; ++bb) {
+    int *dsize = diag->dsize[bb], *offset = diag->offset[bb];
+    double *block = cur[bb] + diag->margin*dsize[1] + diag->margin;
+    sumBlock(block, dsize[1], dsize[0]-2*diag->margin, dsize[1]-2*diag->margin, diag->rows+offset[0], diag->cols+offset[1], &total);
+  }
+  int rank; MPI_Comm_rank(diag->comm, &rank);
+  MPI_Reduce(rank == 0 ? MPI_IN_PLACE : diag->rows, diag->rows, diag->fsize[0], MPI_DOUBLE, MPI_SUM, 0, diag->comm);
+  MPI_Reduce(rank == 0 ? MPI_IN_PLACE : diag->cols, diag->cols, diag->fsize[1], MPI_DOUBLE, MPI_SUM, 0, diag->comm);
+  MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &total, &total, 1, MPI_DOUBLE, MPI_SUM, 0, diag->comm);
+
+  for (int yy=0; yy<diag->fsize[0]; ++yy) diag->rows[yy] /= diag->fsize[1];
+  for (int xx=0; xx<diag->fsize[1]; ++xx) diag->cols[xx] /= diag->fsize[0];
+  total /= (double)diag->fsize[0]*diag->fsize[1];
+
+  // the first process writes the values, the others take part in the collective writes with an empty array
+  int xsize[2]  = { rank == 0 ? diag->fsize[0] : 0, 1 };
+  int ysize[2]  = { rank == 0 ? diag->fsize[1] : 0, 1 };
+  int msize[2]  = { rank == 0, 1 };
+  int xfsize[2] = { diag->fsize[0], 1 };
+  int yfsize[2] = { diag->fsize[1], 1 };
+  int mfsize[2] = { 1, 1 };
+  writeFrame(diag->groupId, &total, msize, 0, mfsize, 0, 0, 1, "./mean");
+  writeFrame(diag->groupId, diag->rows, xsize, 0, xfsize, 0, 0, 1, "./x_mean");
+  writeFrame(diag->groupId, diag->cols, ysize, 0, yfsize, 0, 0, 1, "./y_mean");
+}
+
+/** A function to compute the mean of the whole problem, of each row (x_mean) and of each column (y_mean)
+ * @param[in]  diag   the description of the diagnostics output
+ * @param[in]  prev   unused
+ * @param[in]  cur	the data blocks at the iteration step
+ * @param	  step   the iteration
+ */
+void insitu_mean(struct insitu *diag, double **prev, double **cur, int step)
+{
+  if ( diag->row_comm == MPI_COMM_NULL ) {
+    insitu_mean_transit(diag, cur);
+    return;
+  }
+
+  int *dsize = diag->dsize[0], *offset = diag->offset[0];
+  int rows = dsize[0]-2*diag->margin, cols = dsize[1]-2*diag->margin;
+  double *block = cur[0] + diag->margin*dsize[1] + diag->margin;
+
+  // local sums, then over the processes sharing the rows or the columns
+  double total = 0;
+  memset(diag->rows, 0, sizeof(double)*rows);
+  memset(diag->cols, 0, sizeof(double)*cols);
+  sumBlock(block, dsize[1], rows, cols, diag->rows, diag->cols, &total);
+  MPI_Allreduce(MPI_IN_PLACE, diag->rows, rows, MPI_DOUBLE, MPI_SUM, diag->row_comm);
+  MPI_Allreduce(MPI_IN_PLACE, diag->cols, cols, MPI_DOUBLE, MPI_SUM, diag->col_comm);
+  MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_DOUBLE, MPI_SUM, diag->comm);
+
+  for (int yy=0; yy<rows; ++yy) diag->rows[yy] /= diag->fsize[1];
+  for (int xx=0; xx<cols; ++xx) diag->cols[xx] /= diag->fsize[0];
+  total /= (double)diag->fsize[0]*diag->fsize[1];
+
+  // the values are written by the first column, the first row and the first process of the grid;
+  // the other processes take part in the collective writes with an empty block
+  int column, row; MPI_Comm_rank(diag->row_comm, &column); MPI_Comm_rank(diag->col_comm, &row);
+  int xsize[2]  = { column == 0 ? rows : 0, 1 };
+  int ysize[2]  = { row == 0 ? cols : 0, 1 };
+  int msize[2]  = { row == 0 && column == 0, 1 };
+  int xfsize[2] = { diag->fsize[0], 1 };
+  int yfsize[2] = { diag->fsize[1], 1 };
+  int mfsize[2] = { 1, 1 };
+  writeFrame(diag->groupId, &total, msize, 0, mfsize, 0, 0, 1, "./mean");
+  writeFrame(diag->groupId, diag->rows, xsize, 0, xfsize, offset[0], 0, 1, "./x_mean");
+  writeFrame(diag->groupId, diag->cols, ysize, 0, yfsize, offset[1], 0, 1, "./y_mean");
+}
+
+/** A function to compute the difference between two successive iterations
+ * @param[in]  diag   the description of the diagnostics output
+ * @param[in]  prev   the data blocks at the previous iteration, nothing is written if NULL
+ * @param[in]  cur	the data blocks at the iteration step
+ * @param	  step   the iteration
+ */
+void insitu_derivative(struct insitu *diag, double **prev, double **cur, int step)
+{
+  // the first iteration has no derivative
+  if ( !prev ) return;
+
+  // all the processes hold the same number of blocks, each one is written collectively
+  for (int bb=0; bb<diag->nb_blocks; ++bb) {
+    int *dsize = diag->dsize[bb], *offset = diag->offset[bb];
+    int rows = dsize[0]-2*diag->margin, cols = dsize[1]-2*diag->margin;
+    int skip = diag->margin*dsize[1] + diag->margin;
+
+    diffBlock(prev[bb] + skip, cur[bb] + skip, dsize[1], rows, cols, diag->points, cols);
+    int psize[2] = { rows, cols };
+    writeFrame(diag->groupId, diag->points, psize, 0, diag->fsize, offset[0], offset[1], 1, "./derivative");
+  }
+}
+
+/** A function to compute the diagnostics of an iteration and write them in the group /<step> of diags.h5
+ * @param[in]  diag   the description of the diagnostics output
+ * @param[in]  opts   the diagnostics selected on the command line
+ * @param[in]  prev   the data blocks at the previous iteration, NULL if they are not available
+ * @param[in]  cur	the data blocks at the iteration step
+ * @param	  step   the iteration
+ */
+void run_insitu(struct insitu *diag, struct options *opts, double **prev, double **cur, int step)
+{
+  diag->groupId = createGroup(diag->fileId, "/%d", step);
+  for (int hh=0; hh<opts->nb_hooks; ++hh) {
+    opts->hooks[hh](diag, prev, cur, step);
+  }
+  closeGroup(diag->groupId);
+}
+
+/** The diagnostics that can be computed in the solver, selected by name with --insitu */
+struct {
+  const char *name;
+  insitu_hook hook;
+  /// whether the diagnostic needs the previous iteration
+  int prev;
+} insitu_hooks[] = {
+  { "mean", insitu_mean, 0 },
+  { "derivative", insitu_derivative, 1 },
+};
+
 /** A function to parse command line arguments
  * @param	  argc	  number of arguments received on the command line
  * @param[in]  argv	  values of arguments received on the command line
  * @param[out] nb_iter   number of iterations to execute
  * @param[out] dsize	 size of the local data block (including ghost zones)
+ * @param[out] fsize	 size of the whole problem
+ * @param[out] offset	position of the local data block in the whole problem
+ * @param[out] max_block size of the largest local data block of all processes (without ghost zones)
  * @param[out] cart_comm a MPI Cartesian communicator including all processes arranged in grid
+ * @param[out] pcoord	position of the local data block in the array of data blocks
+ * @param[out] opts	  the optional behaviours selected after the mandatory arguments
+ * @param[out] ana_comm  a MPI communicator including the analysis processes on these processes,
+ *					   MPI_COMM_NULL on the solver processes (cart_comm is MPI_COMM_NULL on the former)
  */
-void parse_args( int argc, char *argv[], int *nb_iter, int dsize[2], int fsize[2], MPI_Comm *cart_comm )
+void parse_args( int argc, char *argv[], int *nb_iter, int dsize[2], int fsize[2], int offset[2], int max_block[2], MPI_Comm *cart_comm, int pcoord[2], struct options *opts, MPI_Comm *ana_comm )
 {
-  if ( argc != 4 ) {
-    printf("Usage: %s <Nb_iter> <height> <width>\n", argv[0]);
+  if ( argc < 4 ) {
+    printf("Usage: %s <Nb_iter> <height> <width> [--overlap] [--async <depth>] [--every <K>] [--steps <s1,s2,...>] [--stride <S>] [--series] [--deflate <level>] [--shuffle] [--kernel <ref|tiled>] [--tile <h>x<w>] [--halo <h>] [--checkpoint <K>] [--checkpoint-time <T>] [--restart] [--insitu <mean,derivative>] [--insitu-every <K>] [--transit <N>] [--transit-depth <D>] [--converge <tol>] [--converge-every <M>] [--implicit <k>] [--cg-tol <tol>] [--store <double|float>] [--compute <double|float>] [--subfiles <node|N>]\n", argv[0]);
     exit(1);
   }
 
-  // total number of processes
-  int comm_size; MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
-  int psize[2];
-
-  // number of processes in the x dimension
-  psize[0] = sqrt(comm_size);
-  if ( psize[0]<1 ) psize[0]=1; 
-  // number of processes in the y dimension
-  psize[1] = comm_size/psize[0];
-  // make sure the total number of processes is correct
-  if (psize[0]*psize[1] != comm_size) {
-    fprintf(stderr, "Error: invalid number of processes\n");
-    abort();
+  // optional arguments
+  opts->overlap = 0;
+  opts->async_depth = 0;
+  opts->every = 1;
+  opts->steps = NULL;
+  opts->nb_steps = 0;
+  opts->stride = 1;
+  opts->series = 0;
+  opts->deflate = 0;
+  opts->shuffle = 0;
+  opts->tiled = 0;
+  opts->tile[0] = opts->tile[1] = 0;
+  opts->halo = 1;
+  opts->checkpoint_every = 0;
+  opts->checkpoint_time = 0;
+  opts->restart = 0;
+  opts->nb_hooks = 0;
+  opts->insitu_every = 1;
+  opts->insitu_prev = 0;
+  opts->transit = 0;
+  opts->transit_depth = 2;
+  opts->converge = 0;
+  opts->converge_every = 10;
+  opts->implicit = 0;
+  opts->cg_tol = 1e-8;
+  opts->store_single = 0;
+  opts->compute_single = 0;
+  opts->subfiles = 0;
+  for (int ii=4; ii<argc; ++ii) {
+    if ( !strcmp(argv[ii], "--overlap") ) {
+      opts->overlap = 1;
+    } else if ( !strcmp(argv[ii], "--async") && ii+1<argc ) {
+      opts->async_depth = atoi(argv[++ii]);
+      if ( opts->async_depth < 1 ) {
+        fprintf(stderr, "Error: invalid number of staging buffers\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--every") && ii+1<argc ) {
+      opts->every = atoi(argv[++ii]);
+      if ( opts->every < 1 ) {
+        fprintf(stderr, "Error: invalid output period\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--steps") && ii+1<argc ) {
+      ++ii;
+      opts->steps = malloc(sizeof(int)*(strlen(argv[ii])/2+1));
+      for (char *step = strtok(argv[ii], ","); step; step = strtok(NULL, ",")) {
+        opts->steps[opts->nb_steps++] = atoi(step);
+      }
+    } else if ( !strcmp(argv[ii], "--stride") && ii+1<argc ) {
+      opts->stride = atoi(argv[++ii]);
+      if ( opts->stride < 1 ) {
+        fprintf(stderr, "Error: invalid output stride\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--series") ) {
+      opts->series = 1;
+    } else if ( !strcmp(argv[ii], "--deflate") && ii+1<argc ) {
+      opts->deflate = atoi(argv[++ii]);
+      if ( opts->deflate < 0 || opts->deflate > 9 ) {
+        fprintf(stderr, "Error: invalid deflate level\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--shuffle") ) {
+      opts->shuffle = 1;
+    } else if ( !strcmp(argv[ii], "--kernel") && ii+1<argc ) {
+      ++ii;
+      if ( !strcmp(argv[ii], "tiled") ) {
+        opts->tiled = 1;
+      } else if ( strcmp(argv[ii], "ref") ) {
+        fprintf(stderr, "Error: unknown kernel %s\n", argv[ii]);
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--tile") && ii+1<argc ) {
+      ++ii;
+      char end;
+      if ( sscanf(argv[ii], "%dx%d%c", &opts->tile[0], &opts->tile[1], &end) != 2 || opts->tile[0] < 1 || opts->tile[1] < 1 ) {
+        fprintf(stderr, "Error: invalid tile size %s\n", argv[ii]);
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--halo") && ii+1<argc ) {
+      opts->halo = atoi(argv[++ii]);
+      if ( opts->halo < 1 ) {
+        fprintf(stderr, "Error: invalid ghost zone width\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--checkpoint") && ii+1<argc ) {
+      opts->checkpoint_every = atoi(argv[++ii]);
+      if ( opts->checkpoint_every < 1 ) {
+        fprintf(stderr, "Error: invalid checkpoint period\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--checkpoint-time") && ii+1<argc ) {
+      opts->checkpoint_time = atof(argv[++ii]);
+      if ( opts->checkpoint_time <= 0 ) {
+        fprintf(stderr, "Error: invalid checkpoint interval\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--restart") ) {
+      opts->restart = 1;
+    } else if ( !strcmp(argv[ii], "--insitu") && ii+1<argc ) {
+      for (char *name = strtok(argv[++ii], ","); name; name = strtok(NULL, ",")) {
+        int hh = 0, nb_names = sizeof(insitu_hooks)/sizeof(insitu_hooks[0]);
+        while ( hh<nb_names && strcmp(name, insitu_hooks[hh].name) ) ++hh;
+        if ( hh == nb_names ) {
+          fprintf(stderr, "Error: unknown diagnostic %s\n", name);
+          abort();
+        }
+        // a diagnostic is computed once even if it is listed twice
+        int selected = 0;
+        for (int jj=0; jj<opts->nb_hooks; ++jj) selected |= opts->hooks[jj] == insitu_hooks[hh].hook;
+        if ( !selected ) {
+          opts->hooks[opts->nb_hooks++] = insitu_hooks[hh].hook;
+          opts->insitu_prev |= insitu_hooks[hh].prev;
+        }
+      }
+    } else if ( !strcmp(argv[ii], "--insitu-every") && ii+1<argc ) {
+      opts->insitu_every = atoi(argv[++ii]);
+      if ( opts->insitu_every < 1 ) {
+        fprintf(stderr, "Error: invalid diagnostics period\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--transit") && ii+1<argc ) {
+      opts->transit = atoi(argv[++ii]);
+      if ( opts->transit < 1 ) {
+        fprintf(stderr, "Error: invalid number of analysis processes\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--transit-depth") && ii+1<argc ) {
+      opts->transit_depth = atoi(argv[++ii]);
+      if ( opts->transit_depth < 1 ) {
+        fprintf(stderr, "Error: invalid number of frames in flight\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--converge") && ii+1<argc ) {
+      opts->converge = atof(argv[++ii]);
+      if ( opts->converge <= 0 ) {
+        fprintf(stderr, "Error: invalid convergence tolerance\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--converge-every") && ii+1<argc ) {
+      opts->converge_every = atoi(argv[++ii]);
+      if ( opts->converge_every < 1 ) {
+        fprintf(stderr, "Error: invalid convergence check period\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--implicit") && ii+1<argc ) {
+      opts->implicit = atof(argv[++ii]);
+      if ( opts->implicit <= 0 ) {
+        fprintf(stderr, "Error: invalid implicit time step\n");
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--cg-tol") && ii+1<argc ) {
+      opts->cg_tol = atof(argv[++ii]);
+      if ( opts->cg_tol <= 0 || opts->cg_tol >= 1 ) {
+        fprintf(stderr, "Error: invalid conjugate gradients tolerance\n");
+        abort();
+      }
+    } else if ( (!strcmp(argv[ii], "--store") || !strcmp(argv[ii], "--compute")) && ii+1<argc ) {
+      int *single = !strcmp(argv[ii], "--store") ? &opts->store_single : &opts->compute_single;
+      ++ii;
+      if ( !strcmp(argv[ii], "float") ) {
+        *single = 1;
+      } else if ( strcmp(argv[ii], "double") ) {
+        fprintf(stderr, "Error: unknown precision %s\n", argv[ii]);
+        abort();
+      }
+    } else if ( !strcmp(argv[ii], "--subfiles") && ii+1<argc ) {
+      ++ii;
+      // node, or a number of processes of at least 1
+      char *end;
+      long group = strtol(argv[ii], &end, 10);
+      opts->subfiles = !strcmp(argv[ii], "node") ? SUBFILES_NODE : (int)group;
+      if ( strcmp(argv[ii], "node") && (*end || end == argv[ii] || group < 1 || group > INT_MAX) ) {
+        fprintf(stderr, "Error: invalid number of processes per subfile\n");
+        abort();
+      }
+    } else {
+      fprintf(stderr, "Error: unknown option %s\n", argv[ii]);
+      abort();
+    }
   }
 
   // number of iterations
   *nb_iter = atoi(argv[1]);
 
-  // global width of the problem
-  dsize[1] = atoi(argv[3]);
-  fsize[1] = dsize[1];
-  if ( dsize[1]%psize[1] != 0) {
-    fprintf(stderr, "Error: invalid problem width\n");
+  // global height and width of the problem
+  fsize[0] = atoi(argv[2]);
+  fsize[1] = atoi(argv[3]);
+
+  // the last opts->transit processes write the frames and the diagnostics of the others, which
+  // are split evenly between them
+  int comm_size; MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
+  int world_rank; MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int nb_sim = comm_size - opts->transit;
+  if ( opts->transit && (nb_sim < 1 || nb_sim % opts->transit) ) {
+    fprintf(stderr, "Error: the number of solver processes is not a multiple of the number of analysis processes\n");
+    abort();
+  }
+  if ( opts->transit && opts->async_depth ) {
+    fprintf(stderr, "Error: --async and --transit are exclusive\n");
     abort();
   }
-  // width of the local data block (add boundary or ghost zone: 1 point on each side)
-  dsize[1]  = dsize[1]/psize[1]  + 2;
+  // the implicit step has its own kernel and exchanges its ghost zones of 1 point at each iteration of the solver
+  if ( opts->implicit > 0 && (opts->tiled || opts->overlap || opts->halo > 1) ) {
+    fprintf(stderr, "Error: --implicit is exclusive with --kernel tiled, --overlap and --halo\n");
+    abort();
+  }
+  // the iterations in single precision exchange ghost zones of 1 point at each iteration, without checking their change
+  if ( opts->compute_single && (opts->overlap || opts->halo > 1 || opts->implicit > 0 || opts->converge > 0) ) {
+    fprintf(stderr, "Error: --compute float is exclusive with --overlap, --halo, --implicit and --converge\n");
+    abort();
+  }
+  // the virtual datasets of the master file present frames of a fixed size, written by the solver processes
+  if ( opts->subfiles && (opts->series || opts->transit) ) {
+    fprintf(stderr, "Error: --subfiles is exclusive with --series and --transit\n");
+    abort();
+  }
+  // the analysis processes expect the frames up to the last iteration
+  if ( opts->transit && opts->converge > 0 ) {
+    fprintf(stderr, "Error: --converge and --transit are exclusive\n");
+    abort();
+  }
+  MPI_Comm sim_comm = MPI_COMM_WORLD;
+  *ana_comm = MPI_COMM_NULL;
+  if ( opts->transit ) {
+    MPI_Comm comm;
+    MPI_Comm_split(MPI_COMM_WORLD, world_rank >= nb_sim, world_rank, &comm);
+    if ( world_rank >= nb_sim ) {
+      *ana_comm = comm;
+    } else {
+      sim_comm = comm;
+    }
+  }
 
-  // global height of the problem
-  dsize[0] = atoi(argv[2]);
-  fsize[0] = dsize[0];
-  if ( dsize[0]%psize[0] != 0) {
-    fprintf(stderr, "Error: invalid problem height\n");
+  // solver processes, arranged in a grid that follows the aspect ratio of the problem
+  int psize[2];
+  splitProcesses(nb_sim, fsize, psize);
+  if ( !psize[0] ) {
+    fprintf(stderr, "Error: invalid number of processes\n");
     abort();
   }
-  // height of the local data block (add boundary or ghost zone: 1 point on each side)
-  dsize[0] = dsize[0]/psize[0] + 2;
+
+  // size of the largest local data block, without the ghost zones
+  for (int dd=0; dd<2; ++dd) {
+    int start;
+    splitRange(fsize[dd], psize[dd], 0, &max_block[dd], &start);
+  }
+
+  // the analysis processes hold no data block
+  if ( *ana_comm != MPI_COMM_NULL ) {
+    *cart_comm = MPI_COMM_NULL;
+    return;
+  }
 
   // creation of the communicator
   int cart_period[2] = { 0, 0 };
-  MPI_Cart_create(MPI_COMM_WORLD, 2, psize, cart_period, 1, cart_comm);
+  MPI_Cart_create(sim_comm, 2, psize, cart_period, 1, cart_comm);
+  if ( sim_comm != MPI_COMM_WORLD ) {
+    MPI_Comm_free(&sim_comm);
+  }
+
+  // coordinate of the local process
+  int cart_rank; MPI_Comm_rank(*cart_comm, &cart_rank);
+  MPI_Cart_coords(*cart_comm, cart_rank, 2, pcoord);
+
+  // the remaining rows and columns are spread over the first processes of each dimension
+  for (int dd=0; dd<2; ++dd) {
+    splitRange(fsize[dd], psize[dd], pcoord[dd], &dsize[dd], &offset[dd]);
+    // size of the local data block (add boundary or ghost zone: halo points on each side)
+    dsize[dd] += 2*opts->halo;
+  }
+
+  // the ghost zones are filled by the direct neighbours only
+  if ( dsize[0] < 3*opts->halo || dsize[1] < 3*opts->halo ) {
+    fprintf(stderr, "Error: ghost zones wider than the local data block\n");
+    abort();
+  }
+
+}
+
+/** A function to write a frame of the local data block, called either in the time loop or by the
+ * writer thread
+ * @param	  ctx	the output description (struct output)
+ * @param[in]  data   the local data block (including ghost zones)
+ * @param	  step   the iteration the local data block corresponds to
+ */
+void write_step(void *ctx, double *data, int step)
+{
+  struct output *out = ctx;
+  if ( out->subfilesId >= 0 ) {
+    writeSubfiledFrame(out->subfilesId, data, "/step%d", step);
+  } else if ( out->seriesId >= 0 ) {
+    writeSeriesFrame(out->seriesId, step, data, out->dsize, out->margin, out->stride, out->fsize, out->offset[0], out->offset[1], 1);
+  } else {
+    writeLayoutFrame(out->layoutId, out->fileId, data, "/step%d", step);
+  }
+}
+
+/** A function to write the state of the solver in a checkpoint file. The checkpoints alternate
+ * between two files so that the previous one is still complete if the run stops while writing;
+ * heat_ckpt.last names the last complete checkpoint.
+ * @param	  cart_comm the communicator of the solver processes
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  halo   width of the ghost zones, not written
+ * @param	  fsize  size of the whole problem
+ * @param	  offset position of the local data block in the whole problem
+ * @param[in]  cur	the local data block at the iteration step
+ * @param	  step   the iteration the local data block corresponds to
+ */
+void write_checkpoint(MPI_Comm cart_comm, int dsize[2], int halo, int fsize[2], int offset[2], double *cur, int step)
+{
+  static int slot = 0;
+
+  // the whole problem is stored, independently of the decomposition
+  int fileId = createFile(1, "heat_ckpt%d.h5", slot);
+  writeFrame(fileId, cur, dsize, halo, fsize, offset[0], offset[1], 1, "/field");
+  writeIntAttribute(fileId, "/field", "step", step);
+  writeIntAttribute(fileId, "/field", "height", fsize[0]);
+  writeIntAttribute(fileId, "/field", "width", fsize[1]);
+  closeFile(fileId, 1);
+
+  // the file is closed on all processes, record it as the last checkpoint
+  int rank; MPI_Comm_rank(cart_comm, &rank);
+  if ( rank == 0 ) {
+    FILE *last = fopen("heat_ckpt.tmp", "w");
+    if ( !last ) {
+      fprintf(stderr, "Error: cannot write heat_ckpt.tmp\n");
+      abort();
+    }
+    fprintf(last, "%d\n", slot);
+    fclose(last);
+    rename("heat_ckpt.tmp", "heat_ckpt.last");
+  }
+
+  slot = 1 - slot;
+}
+
+/** A function to read the state of the solver from the last checkpoint, possibly written with
+ * another number of processes
+ * @param	  cart_comm the communicator of the solver processes
+ * @param	  dsize  size of the local data block (including ghost zones)
+ * @param	  halo   width of the ghost zones, not read
+ * @param	  fsize  size of the whole problem
+ * @param	  offset position of the local data block in the whole problem
+ * @param[out] cur	the local data block, its ghost zones are left untouched
+ * @return	 the iteration of the checkpoint
+ */
+int read_checkpoint(MPI_Comm cart_comm, int dsize[2], int halo, int fsize[2], int offset[2], double *cur)
+{
+  int rank; MPI_Comm_rank(cart_comm, &rank);
+  int slot = -1;
+  if ( rank == 0 ) {
+    FILE *last = fopen("heat_ckpt.last", "r");
+    if ( !last || fscanf(last, "%d", &slot) != 1 ) slot = -1;
+    if ( last ) fclose(last);
+  }
+  MPI_Bcast(&slot, 1, MPI_INT, 0, cart_comm);
+  if ( slot < 0 ) {
+    fprintf(stderr, "Error: no checkpoint to restart from\n");
+    abort();
+  }
+
+  int fileId = openFile(1, "heat_ckpt%d.h5", slot);
+  int dims[2] = { readIntAttribute(fileId, "/field", "height"), readIntAttribute(fileId, "/field", "width") };
+  if ( dims[0] != fsize[0] || dims[1] != fsize[1] ) {
+    fprintf(stderr, "Error: the checkpoint is %dx%d\n", dims[0], dims[1]);
+    abort();
+  }
+  readFrame(fileId, cur, dsize, halo, fsize, offset[0], offset[1], 1, "/field");
+  int step = readIntAttribute(fileId, "/field", "step");
+  closeFile(fileId, 1);
+
+  return step;
+}
+
+/** The clock of --checkpoint-time: the first process decides for all, since the clocks of the processes differ,
+ * and broadcasts its decision without blocking; it is only waited for at the next test of the clock */
+struct checkpoint_timer {
+  /// time of the previous checkpoint, measured on the first process
+  double last_time;
+  /// the broadcast of the decision of the first process, MPI_REQUEST_NULL if none is in flight
+  MPI_Request req;
+  int late;
+  /// set when a checkpoint was written while the broadcast was in flight, its decision is then obsolete
+  int stale;
+};
+
+/** A function to decide whether a checkpoint is written after an iteration
+ * @param		 cart_comm the communicator of the solver processes
+ * @param[in]	 opts	  the checkpoint cadence selected on the command line
+ * @param		 ii		the iteration before the last update
+ * @param		 nsteps	number of iterations of the last update
+ * @param[in,out] timer	 the clock of the checkpoints
+ * @return		1 if all processes write a checkpoint of the iteration ii+nsteps, 0 otherwise
+ */
+int is_checkpoint_step(MPI_Comm cart_comm, struct options *opts, int ii, int nsteps, struct checkpoint_timer *timer)
+{
+  // a period may be crossed in the middle of a block of iterations of iter_deep
+  int due = opts->checkpoint_every && (ii+nsteps)/opts->checkpoint_every > ii/opts->checkpoint_every;
+  if ( opts->checkpoint_time > 0 && (ii+nsteps)/CHECKPOINT_TIME_EVERY > ii/CHECKPOINT_TIME_EVERY ) {
+    // the decision broadcast at the previous test has had CHECKPOINT_TIME_EVERY iterations to arrive
+    if ( timer->req != MPI_REQUEST_NULL ) {
+      MPI_Wait(&timer->req, MPI_STATUS_IGNORE);
+      due |= timer->late && !timer->stale;
+    }
+    int rank; MPI_Comm_rank(cart_comm, &rank);
+    timer->late = rank == 0 && MPI_Wtime() - timer->last_time >= opts->checkpoint_time;
+    timer->stale = 0;
+    MPI_Ibcast(&timer->late, 1, MPI_INT, 0, cart_comm, &timer->req);
+  }
+  if ( due ) {
+    timer->last_time = MPI_Wtime();
+    timer->stale = 1;
+  }
+  return due;
+}
+
+/** A function to find the thread support required from MPI by the command line options
+ * @param	  argc	  number of arguments received on the command line
+ * @param[in]  argv	  values of arguments received on the command line
+ * @return	 the MPI thread support level to request
+ */
+int thread_level( int argc, char *argv[] )
+{
+  // the writer thread issues collective HDF5 calls while the main thread exchanges ghost zones
+  for (int ii=4; ii<argc; ++ii) {
+    if ( !strcmp(argv[ii], "--async") ) return MPI_THREAD_MULTIPLE;
+  }
+  // the OpenMP threads only compute, all communications go through the main thread
+  return MPI_THREAD_FUNNELED;
+}
+
+/** A function to compute the chunks of the compressed frames, the same on all processes. The decimated local data
+ * blocks start on the multiples of the greatest common divisor of their offsets: when it is at least half a block,
+ * it is the chunk size and no chunk is shared by two processes. Otherwise (uneven blocks, or blocks that are not a
+ * multiple of the stride), the chunks have the size of the largest decimated block and the processes share the chunks
+ * on their borders, which the collective writes of compressed datasets support at the cost of more communications.
+ * @param[in]  opts	  the options selected on the command line
+ * @param	  fsize	 size of the whole problem
+ * @param	  max_block size of the largest local data block of all solver processes (without ghost zones)
+ * @param[out] chunk	 size of the chunks in each dimension
+ */
+void frame_chunk(struct options *opts, int fsize[2], int max_block[2], int chunk[2])
+{
+  // the grid of the solver processes, as arranged by parse_args
+  int comm_size; MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
+  int psize[2];
+  splitProcesses(comm_size-opts->transit, fsize, psize);
+
+  for (int dd=0; dd<2; ++dd) {
+    chunk[dd] = (max_block[dd]+opts->stride-1)/opts->stride;
+    // greatest common divisor of the decimated offsets of the blocks
+    int common = 0;
+    for (int pp=1; pp<psize[dd]; ++pp) {
+      int count, start;
+      splitRange(fsize[dd], psize[dd], pp, &count, &start);
+      int first = (start+opts->stride-1)/opts->stride;
+      while ( first ) {
+        int rest = common%first; common = first; first = rest;
+      }
+    }
+    if ( common && 2*common >= chunk[dd] ) {
+      chunk[dd] = common;
+    }
+  }
+}
+
+/** A function to open the output file heat.h5, or to reopen it to continue after a restart
+ * @param[in,out] out	   the output description, whose file and time series are set
+ * @param[in]	 opts	  the output options selected on the command line
+ * @param		 max_block size of the largest local data block of all processes (without ghost zones)
+ * @param		 start	 the iteration the run starts from
+ */
+void open_output(struct output *out, struct options *opts, int max_block[2], int start)
+{
+  out->seriesId = -1;
+  out->layoutId = -1;
+  out->subfilesId = -1;
+  setFrameType(opts->store_single);
+
+  // about one chunk per local data block, the chunks have the same size on all processes
+  int chunk[2];
+  frame_chunk(opts, out->fsize, max_block, chunk);
+  if ( opts->deflate || opts->shuffle ) {
+    setCompression(chunk, opts->deflate, opts->shuffle);
+  }
+
+  // the frames are written in the subfiles heat.h5.<rank>, heat.h5 only holds their virtual datasets
+  if ( opts->subfiles ) {
+    out->fileId = -1;
+    out->subfilesId = createSubfiles(opts->subfiles == SUBFILES_NODE ? 0 : opts->subfiles, opts->restart, out->dsize, out->margin, out->stride, out->fsize, out->offset[0], out->offset[1], "heat.h5");
+    setFrameType(0);
+    return;
+  }
+
+  out->fileId = opts->restart ? appendFile(1, "heat.h5") : createFile(1, "heat.h5");
+  // the readers find the dimensions of the frames even without /step0
+  if ( !opts->restart ) {
+    writeFrameDims(out->fileId, out->fsize, opts->stride);
+  }
+  if ( opts->series ) {
+    int sdims[2] = { (out->fsize[0]+opts->stride-1)/opts->stride, (out->fsize[1]+opts->stride-1)/opts->stride };
+    out->seriesId = opts->restart ? openSeries(out->fileId, start) : createSeries(out->fileId, sdims, chunk);
+  } else {
+    // the dataspaces and property lists are created once for all the frames
+    out->layoutId = createLayout(out->dsize, out->margin, out->stride, out->fsize, out->offset[0], out->offset[1], 1);
+  }
+  // the checkpoints and the diagnostics stay in double precision
+  setFrameType(0);
+}
+
+/** A function to close the output file heat.h5
+ * @param[in]  out	the output description
+ */
+void close_output(struct output *out)
+{
+  if ( out->subfilesId >= 0 ) {
+    closeSubfiles(out->subfilesId);
+    return;
+  }
+  if ( out->seriesId >= 0 ) {
+    closeSeries(out->seriesId);
+  } else {
+    closeLayout(out->layoutId);
+  }
+  closeFile(out->fileId, 1);
+}
+
+/** A function to open the diagnostics file diags.h5, or to reopen it to continue after a restart
+ * @param[in,out] diag	  the description of the diagnostics output, whose file and work arrays are set
+ * @param[in]	 opts	  the options selected on the command line
+ * @param		 max_block size of the largest local data block of all processes (without ghost zones)
+ */
+void open_insitu(struct insitu *diag, struct options *opts, int max_block[2])
+{
+  diag->fileId = opts->restart ? appendFile(1, "diags.h5") : createFile(1, "diags.h5");
+  int transit = diag->row_comm == MPI_COMM_NULL;
+  diag->rows   = malloc(sizeof(double)*(transit ? diag->fsize[0] : max_block[0]));
+  diag->cols   = malloc(sizeof(double)*(transit ? diag->fsize[1] : max_block[1]));
+  diag->points = malloc(sizeof(double)*max_block[0]*max_block[1]);
+}
+
+/** A function to close the diagnostics file diags.h5
+ * @param[in]  diag   the description of the diagnostics output
+ */
+void close_insitu(struct insitu *diag)
+{
+  closeFile(diag->fileId, 1);
+  if ( diag->row_comm != MPI_COMM_NULL ) {
+    MPI_Comm_free(&diag->row_comm);
+    MPI_Comm_free(&diag->col_comm);
+  }
+  free(diag->rows);
+  free(diag->cols);
+  free(diag->points);
+}
+
+/** A function to write the frames and the diagnostics of the solver processes served by an analysis
+ * process. Each solver process sends the frames needed to this process (see is_needed_step), in order,
+ * and replaces the frames it could not send without waiting by an empty message; a frame is written
+ * only if all its blocks were received by all the analysis processes.
+ * @param[in]  opts	  the options selected on the command line
+ * @param	  nb_iter   number of iterations executed by the solver
+ * @param	  fsize	 size of the whole problem
+ * @param	  max_block size of the largest local data block of all solver processes (without ghost zones)
+ * @param	  ana_comm  a MPI communicator including all analysis processes
+ * @param	  start	 the iteration the solver starts from
+ */
+void serve_transit(struct options *opts, int nb_iter, int fsize[2], int max_block[2], MPI_Comm ana_comm, int start)
+{
+  // the nb_blocks solver processes served by this process
+  int comm_size; MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
+  int ana_rank; MPI_Comm_rank(ana_comm, &ana_rank);
+  int nb_blocks = (comm_size-opts->transit)/opts->transit;
+  int first = ana_rank*nb_blocks;
+
+  // size and position of their local data blocks, without ghost zones
+  int dsize[nb_blocks][2], offset[nb_blocks][2];
+  double *blocks[nb_blocks], *prev[nb_blocks];
+  for (int bb=0; bb<nb_blocks; ++bb) {
+    int header[4];
+    MPI_Recv(header, 4, MPI_INT, first+bb, 301, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    dsize[bb][0] = header[0]; dsize[bb][1] = header[1];
+    offset[bb][0] = header[2]; offset[bb][1] = header[3];
+    blocks[bb] = malloc(sizeof(double)*dsize[bb][0]*dsize[bb][1]);
+    prev[bb] = malloc(sizeof(double)*dsize[bb][0]*dsize[bb][1]);
+  }
+
+  // the analysis processes share the output files
+  setIOComm(ana_comm);
+  struct output out = {
+    .dsize  = { dsize[0][0], dsize[0][1] },
+    .fsize  = { fsize[0], fsize[1] },
+    .offset = { offset[0][0], offset[0][1] },
+    .margin = 0,
+    .stride = opts->stride,
+  };
+  open_output(&out, opts, max_block, start);
+  // without time series, each block has its own layout in the file
+  int layouts[nb_blocks];
+  layouts[0] = out.layoutId;
+  setFrameType(opts->store_single);
+  for (int bb=1; bb<nb_blocks; ++bb) {
+    layouts[bb] = out.seriesId >= 0 ? -1 : createLayout(dsize[bb], 0, opts->stride, fsize, offset[bb][0], offset[bb][1], 1);
+  }
+  setFrameType(0);
+  struct insitu diag = {
+    .fileId = -1,
+    .fsize  = { fsize[0], fsize[1] },
+    .nb_blocks = nb_blocks,
+    .dsize  = dsize,
+    .offset = offset,
+    .margin = 0,
+    .comm   = ana_comm,
+    .row_comm = MPI_COMM_NULL,
+    .col_comm = MPI_COMM_NULL,
+  };
+  if ( opts->nb_hooks ) {
+    open_insitu(&diag, opts, max_block);
+  }
+
+  int skipped = 0, last = -1;
+  for (int step=start; step<=nb_iter; ++step) {
+    if ( !is_needed_step(opts, step) ) continue;
+
+    // the previous frame is kept for the diagnostics that need it
+    int received = 1;
+    for (int bb=0; bb<nb_blocks; ++bb) {
+      double *tmp = prev[bb]; prev[bb] = blocks[bb]; blocks[bb] = tmp;
+      received &= recvFrame(MPI_COMM_WORLD, first+bb, blocks[bb], dsize[bb][0]*dsize[bb][1]);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &received, 1, MPI_INT, MPI_MIN, ana_comm);
+    if ( !received ) {
+      ++skipped;
+      continue;
+    }
+
+    // after a restart, the first frame was written by the previous run
+    if ( step > start || !opts->restart ) {
+      if ( is_output_step(opts, step) ) {
+        // all the analysis processes write the same number of blocks of the frame
+        for (int bb=0; bb<nb_blocks; ++bb) {
+          out.dsize[0] = dsize[bb][0]; out.dsize[1] = dsize[bb][1];
+          out.offset[0] = offset[bb][0]; out.offset[1] = offset[bb][1];
+          out.layoutId = layouts[bb];
+          if ( out.seriesId >= 0 && bb > 0 ) {
+            writeSeriesBlock(out.seriesId, blocks[bb], out.dsize, 0, out.stride, out.offset[0], out.offset[1], 1);
+          } else {
+            write_step(&out, blocks[bb], step);
+          }
+        }
+      }
+      if ( is_insitu_step(opts, step) ) {
+        run_insitu(&diag, opts, last == step-1 ? prev : NULL, blocks, step);
+      }
+    }
+    last = step;
+  }
+
+  if ( skipped && ana_rank == 0 ) {
+    fprintf(stderr, "Warning: %d frames were not received in time by the analysis processes\n", skipped);
+  }
+
+  out.layoutId = layouts[0];
+  close_output(&out);
+  for (int bb=1; bb<nb_blocks; ++bb) {
+    if ( layouts[bb] >= 0 ) closeLayout(layouts[bb]);
+  }
+  if ( opts->nb_hooks ) {
+    close_insitu(&diag);
+  }
+  for (int bb=0; bb<nb_blocks; ++bb) {
+    free(blocks[bb]);
+    free(prev[bb]);
+  }
 }
 
 int main( int argc, char* argv[] )
 {
   // initialize the MPI library
-  MPI_Init(&argc, &argv);
+  int required = thread_level(argc, argv), provided;
+  MPI_Init_thread(&argc, &argv, required, &provided);
+  profileInit();
 
   // parse the command line arguments
   int nb_iter;
   int dsize[2];
   int fsize[2];
-  MPI_Comm cart_comm;
-  parse_args(argc, argv, &nb_iter, dsize, fsize, &cart_comm);
+  int offset[2];
+  int max_block[2];
+  MPI_Comm cart_comm, ana_comm;
+  int pcoord[2];
+  struct options opts;
+  parse_args(argc, argv, &nb_iter, dsize, fsize, offset, max_block, &cart_comm, pcoord, &opts, &ana_comm);
+  if ( provided < required ) {
+    fprintf(stderr, "Error: the MPI library does not support the threads required by the options\n");
+    abort();
+  }
 
-  // find the coordinate of the local process
-  int pcoord_1d; MPI_Comm_rank(MPI_COMM_WORLD, &pcoord_1d);
-  int pcoord[2]; MPI_Cart_coords(cart_comm, pcoord_1d, 2, pcoord);
+  // the analysis processes only receive frames, from the iteration the solver starts from
+  if ( ana_comm != MPI_COMM_NULL ) {
+    int start = 0;
+    if ( opts.restart ) {
+      MPI_Bcast(&start, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    serve_transit(&opts, nb_iter, fsize, max_block, ana_comm, start);
 
-  //printf("%d %d %d %d %d\n", pcoord_1d, pcoord[0], pcoord[1], dsize[0], dsize[1]);
+    MPI_Comm_free(&ana_comm);
+    free(opts.steps);
+    profileReport(MPI_COMM_WORLD);
+    MPI_Finalize();
+    return 0;
+  }
+
+  if ( opts.tile[0] ) {
+    setStencilTile(opts.tile[0], opts.tile[1]);
+  }
+
+  // the checkpoints are shared by the solver processes only
+  if ( opts.transit ) {
+    setIOComm(cart_comm);
+  }
+
+  //printf("%d %d %d %d\n", pcoord[0], pcoord[1], dsize[0], dsize[1]);
 
   // allocate data for the current iteration
   double(*cur)[dsize[1]]  = malloc(sizeof(double)*dsize[1]*dsize[0]);
 
   // initialize data at t=0
-  init(dsize, pcoord, cur);
+  init(dsize, opts.halo, pcoord, cur);
 
-  // allocate data for the next iteration
+  // allocate data for the next iteration, the boundary values are the same in both blocks
   double(*next)[dsize[1]] = malloc(sizeof(double)*dsize[1]*dsize[0]);
+  init(dsize, opts.halo, pcoord, next);
+
+  // sides of the local data block that are a boundary of the problem
+  int fixed[4], rank_up, rank_down, rank_left, rank_right;
+  MPI_Cart_shift(cart_comm, 0, 1, &rank_up, &rank_down);
+  MPI_Cart_shift(cart_comm, 1, 1, &rank_left, &rank_right);
+  fixed[0] = rank_up    == MPI_PROC_NULL;
+  fixed[1] = rank_down  == MPI_PROC_NULL;
+  fixed[2] = rank_left  == MPI_PROC_NULL;
+  fixed[3] = rank_right == MPI_PROC_NULL;
+
+  // continue from the last checkpoint, the boundary values are set by init
+  int start = 0;
+  if ( opts.restart ) {
+    start = read_checkpoint(cart_comm, dsize, opts.halo, fsize, offset, (double*)cur);
+    // the wide ghost zones and the overlapped update fill the ghost zones of cur themselves
+    if ( opts.halo == 1 && !opts.overlap ) {
+      exchange(cart_comm, dsize, cur);
+    }
+    if ( opts.transit ) {
+      MPI_Bcast(&start, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+  }
+
+  // the iterations in single precision, the double precision blocks only hold the iterations used by the
+  // output: the last one in cur, the previous one in next
+  float (*fcur)[dsize[1]] = NULL, (*fnext)[dsize[1]] = NULL;
+  int double_step = start, prev_double_step = -1;
+  if ( opts.compute_single ) {
+    fcur  = malloc(sizeof(float)*dsize[1]*dsize[0]);
+    fnext = malloc(sizeof(float)*dsize[1]*dsize[0]);
+    to_single(dsize, cur, fcur);
+    to_single(dsize, next, fnext);
+  }
 
   // Open file and right first frame
   // Q1
@@ -205,40 +1773,258 @@ int main( int argc, char* argv[] )
   writeFrame(fileId, (double*)cur, dsize, 1, fsize, 0, 0, 1, "/step0");*/
 
   // Q3
-  int fileId = createFile(1, "heat.h5");
-  writeFrame(fileId, (double*)cur, dsize, 1, fsize, pcoord[0] * (dsize[0] - 2), pcoord[1] * (dsize[1] - 2), 1, "/step0");
+  struct output out = {
+    .dsize  = { dsize[0], dsize[1] },
+    .fsize  = { fsize[0], fsize[1] },
+    .offset = { offset[0], offset[1] },
+    .margin = opts.halo,
+    .stride = opts.stride,
+  };
+  // diagnostics computed on the local data block, without reading the frames back
+  struct insitu diag = {
+    .fileId = -1,
+    .fsize  = { fsize[0], fsize[1] },
+    .nb_blocks = 1,
+    .dsize  = &out.dsize,
+    .offset = &out.offset,
+    .margin = opts.halo,
+    .comm   = cart_comm,
+    .row_comm = MPI_COMM_NULL,
+    .col_comm = MPI_COMM_NULL,
+  };
+  double *blocks[1] = { (double*)cur }, *prev[1];
+
+  if ( opts.transit ) {
+    // the frames and the diagnostics are computed by the analysis process serving this one
+    int world_rank; MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    int comm_size; MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
+    int nb_sim = comm_size-opts.transit;
+    int dest = nb_sim + world_rank/(nb_sim/opts.transit);
+    int header[4] = { dsize[0]-2*opts.halo, dsize[1]-2*opts.halo, offset[0], offset[1] };
+    MPI_Send(header, 4, MPI_INT, dest, 301, MPI_COMM_WORLD);
+    startSender(MPI_COMM_WORLD, dest, opts.transit_depth, dsize, opts.halo);
+    if ( is_needed_step(&opts, start) ) {
+      sendFrame((double*)cur);
+    }
+  } else {
+    open_output(&out, &opts, max_block, start);
+    if ( !opts.restart && is_output_step(&opts, 0) ) {
+      write_step(&out, (double*)cur, 0);
+    }
+    if ( opts.nb_hooks ) {
+      int keep_row[2] = { 0, 1 }, keep_column[2] = { 1, 0 };
+      MPI_Cart_sub(cart_comm, keep_row, &diag.row_comm);
+      MPI_Cart_sub(cart_comm, keep_column, &diag.col_comm);
+      open_insitu(&diag, &opts, max_block);
+    }
+    if ( !opts.restart && is_insitu_step(&opts, 0) ) {
+      run_insitu(&diag, &opts, NULL, blocks, 0);
+    }
+  }
+
+  // frames are copied in staging buffers and written by a separate thread
+  if ( opts.async_depth ) {
+    startWriter(opts.async_depth, (size_t)dsize[0]*dsize[1], write_step, &out);
+  }
+
+  // work arrays of the conjugate gradients, 0 on the boundaries of the problem
+  double *cg_work[3] = { NULL, NULL, NULL };
+  long cg_iter = 0, nb_implicit = 0;
+  if ( opts.implicit > 0 ) {
+    for (int ww=0; ww<3; ++ww) cg_work[ww] = calloc((size_t)dsize[0]*dsize[1], sizeof(double));
+  }
+
+  // the change of the local data block is reduced without blocking, the result is only waited for at the
+  // next check, converge_every iterations later
+  MPI_Request converge_req = MPI_REQUEST_NULL;
+  // the buffers of the reduction, which are not modified while it is in flight
+  double local_change = 0, sent_change = 0, global_change = 0;
+  int converged = 0, converge_step = 0;
 
   // the main (time) iteration
-  for (int ii=0; ii<nb_iter; ++ii) {
+  int nsteps, valid = 0;
+  struct checkpoint_timer checkpoint_timer = { MPI_Wtime(), MPI_REQUEST_NULL, 0, 0 };
+  for (int ii=start; ii<nb_iter && !converged; ii+=nsteps) {
+    nsteps = 1;
+    // the change is computed when nsteps is 1, since the previous iteration is needed
+    int check = is_converge_step(&opts, ii+1);
+
+    if ( opts.compute_single ) {
+      // compute the temperature at the next iteration and update the ghost zones in single precision
+      PROFILE_START(PROFILE_ITER);
+      iter_single(dsize, opts.tiled, fcur, fnext);
+      PROFILE_STOP(PROFILE_ITER, 0);
+      PROFILE_START(PROFILE_EXCHANGE);
+      exchange_single(cart_comm, dsize, fnext);
+      PROFILE_STOP(PROFILE_EXCHANGE, 0);
+    } else if ( opts.implicit > 0 ) {
+      // implicit step, whose ghost zones are updated by the solver
+      cg_iter += implicit_step(cart_comm, dsize, &opts, cur, next, cg_work);
+      ++nb_implicit;
+    } else if ( opts.halo > 1 ) {
+      // wide ghost zones, updated every opts.halo iterations
+      nsteps = iter_deep(cart_comm, dsize, &opts, fixed, &valid, ii, nb_iter, cur, next);
+    } else if ( opts.overlap ) {
+      // start the update of the ghost zones
+      MPI_Request reqs[8];
+      PROFILE_START(PROFILE_EXCHANGE);
+      exchange_begin(cart_comm, dsize, cur, reqs);
+      PROFILE_STOP(PROFILE_EXCHANGE, 0);
+
+      // compute the points that do not need the ghost zones while the messages are in flight
+      PROFILE_START(PROFILE_ITER);
+      if ( opts.tiled ) {
+        stencilTiled(dsize[1], &cur[0][0], &next[0][0], 2, dsize[0]-2, 2, dsize[1]-2);
+      } else {
+        iter_interior(dsize, cur, next);
+      }
+      PROFILE_STOP(PROFILE_ITER, 0);
 
-    // compute the temperature at the next iteration
-    iter(dsize, cur, next);
+      // then the border strip once the ghost zones are up to date
+      PROFILE_START(PROFILE_EXCHANGE);
+      exchange_end(reqs);
+      PROFILE_STOP(PROFILE_EXCHANGE, 0);
+      PROFILE_START(PROFILE_ITER);
+      iter_border(dsize, cur, next);
+      PROFILE_STOP(PROFILE_ITER, 0);
+    } else {
+      // compute the temperature at the next iteration
+      PROFILE_START(PROFILE_ITER);
+      if ( opts.tiled ) {
+        iter_tiled(dsize, cur, next);
+      } else {
+        iter(dsize, cur, next, check ? &local_change : NULL);
+      }
+      PROFILE_STOP(PROFILE_ITER, 0);
 
-    // update ghost zones
-    exchange(cart_comm, dsize, next);
+      // update ghost zones
+      PROFILE_START(PROFILE_EXCHANGE);
+      exchange(cart_comm, dsize, next);
+      PROFILE_STOP(PROFILE_EXCHANGE, 0);
+    }
 
     // switch the current and next buffers
-    double (*tmp)[dsize[1]] = cur; cur = next; next = tmp;
+    if ( opts.compute_single ) {
+      float (*ftmp)[dsize[1]] = fcur; fcur = fnext; fnext = ftmp;
+    } else {
+      double (*tmp)[dsize[1]] = cur; cur = next; next = tmp;
+    }
+
+    // decided before the output, since the block of a checkpoint must be up to date
+    int checkpoint = is_checkpoint_step(cart_comm, &opts, ii, nsteps, &checkpoint_timer);
+
+    // in single precision, the iterations used by the output are converted, the previous one is kept in next
+    if ( opts.compute_single && (is_needed_step(&opts, ii+nsteps) || checkpoint) ) {
+      double (*tmp)[dsize[1]] = cur; cur = next; next = tmp;
+      to_double(dsize, fcur, cur);
+      prev_double_step = double_step;
+      double_step = ii+nsteps;
+    }
+
+    if ( check ) {
+      if ( opts.tiled || opts.overlap || opts.halo > 1 || opts.implicit > 0 ) {
+        PROFILE_START(PROFILE_ITER);
+        local_change = block_change(dsize, opts.halo, next, cur);
+        PROFILE_STOP(PROFILE_ITER, 0);
+      }
+      // the reduction of the previous check has had converge_every iterations to complete
+      PROFILE_START(PROFILE_EXCHANGE);
+      if ( converge_req != MPI_REQUEST_NULL ) {
+        MPI_Wait(&converge_req, MPI_STATUS_IGNORE);
+        converged = global_change < opts.converge;
+      }
+      if ( !converged ) {
+        converge_step = ii+nsteps;
+        sent_change = local_change;
+        MPI_Iallreduce(&sent_change, &global_change, 1, MPI_DOUBLE, MPI_MAX, cart_comm, &converge_req);
+      }
+      PROFILE_STOP(PROFILE_EXCHANGE, 0);
+      int rank; MPI_Comm_rank(cart_comm, &rank);
+      if ( converged && rank == 0 ) {
+        printf("Converged at iteration %d: largest change %g at iteration %d\n", ii+nsteps, global_change, converge_step);
+      }
+    }
 
     // write frame
     // Q1
-    //writeFrame(fileId, (double*)cur, dsize, 0, fsize, 0, 0, "/step%d", ii+1);
+    //writeFrame(fileId, (double*)cur, dsize, 0, fsize, 0, 0, "/step%d", ii+nsteps);
     
     // Q2
-    //writeFrame(fileId, (double*)cur, dsize, 1, fsize, 0, 0, "/step%d", ii+1);
+    //writeFrame(fileId, (double*)cur, dsize, 1, fsize, 0, 0, "/step%d", ii+nsteps);
 
     // Q3
-    writeFrame(fileId, (double*)cur, dsize, 1, fsize, pcoord[0] * (dsize[0] - 2), pcoord[1] * (dsize[1] - 2), 1, "/step%d", ii+1);
+    if ( opts.transit ) {
+      // hand over the frame without waiting for the analysis process
+      if ( is_needed_step(&opts, ii+nsteps) ) {
+        sendFrame((double*)cur);
+      }
+    } else if ( !is_output_step(&opts, ii+nsteps) && !converged ) {
+      // skip this frame, unless it is the last one
+    } else if ( opts.async_depth ) {
+      pushFrame((double*)cur, ii+nsteps);
+    } else {
+      write_step(&out, (double*)cur, ii+nsteps);
+    }
+
+    // compute the diagnostics, after the frames still in the staging buffers since HDF5 is called from one thread at a time
+    if ( !opts.transit && is_insitu_step(&opts, ii+nsteps) ) {
+      if ( opts.async_depth ) {
+        flushWriter();
+      }
+      blocks[0] = (double*)cur; prev[0] = (double*)next;
+      int has_prev = opts.compute_single ? prev_double_step == ii+nsteps-1 : nsteps == 1;
+      run_insitu(&diag, &opts, has_prev ? prev : NULL, blocks, ii+nsteps);
+    }
+
+    // write a checkpoint, after the frames still in the staging buffers since HDF5 is called from one thread at a time
+    if ( checkpoint ) {
+      if ( opts.async_depth ) {
+        flushWriter();
+      }
+      write_checkpoint(cart_comm, dsize, opts.halo, fsize, offset, (double*)cur, ii+nsteps);
+    }
   }
-  
+
+  // the last reduction and the last decision of the clock are not needed
+  if ( converge_req != MPI_REQUEST_NULL ) {
+    MPI_Wait(&converge_req, MPI_STATUS_IGNORE);
+  }
+  if ( checkpoint_timer.req != MPI_REQUEST_NULL ) {
+    MPI_Wait(&checkpoint_timer.req, MPI_STATUS_IGNORE);
+  }
+
+  if ( nb_implicit ) {
+    int rank; MPI_Comm_rank(cart_comm, &rank);
+    if ( rank == 0 ) {
+      printf("Implicit steps: %ld iterations of the conjugate gradients, %.1f per step\n", cg_iter, (double)cg_iter/nb_implicit);
+    }
+  }
+  for (int ww=0; ww<3; ++ww) free(cg_work[ww]);
+
+  // write the remaining frames
+  if ( opts.async_depth ) {
+    stopWriter();
+  }
+
   // Close file
-  closeFile(fileId, 1);
+  if ( opts.transit ) {
+    stopSender();
+  } else {
+    close_output(&out);
+    if ( opts.nb_hooks ) {
+      close_insitu(&diag);
+    }
+  }
 
   // free memory
   free(cur);
   free(next);
+  free(fcur);
+  free(fnext);
+  free(opts.steps);
 
   // finalize MPI
+  profileReport(MPI_COMM_WORLD);
   MPI_Finalize();
 
   return 0;
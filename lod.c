@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <mpi.h>
+#include "hdf5IO.h"
+#include "decomp.h"
+#include "analysis.h"
+#include "profile.h"
+
+// without --levels, the levels are added until the coarsest one fits in LOD_THUMBNAIL x LOD_THUMBNAIL points
+#define LOD_THUMBNAIL 256
+
+
+// Level of detail pyramid of the frames of heat.h5, written in lod.h5: /<step>/lod<l> holds the averages of the blocks of
+// 2^l x 2^l points of the frame of the iteration step, computed from /<step>/lod<l-1>.
+// The blocks of the processes start on multiples of 2^levels points, so that all the levels are computed without communication.
+int main(int argc, char** argv) {
+  // the OpenMP threads only compute, all communications go through the main thread
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  profileInit();
+
+  int size, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // open heat.h5, lod.h5
+  int id_heat = openFile(1, "heat.h5"),
+      id_lod = createFile(1, "lod.h5");
+
+  int fdims[2];
+  getDims(id_heat, fdims);
+
+  int levels = 0, first = 1;
+  if(argc > 2 && !strcmp(argv[1], "--levels")) {
+    levels = strtol(argv[2], NULL, 10);
+    if(levels < 1 || levels > 30) {
+      fprintf(stderr, "Invalid number of levels %s.\n", argv[2]);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    first = 3;
+  } else {
+    do {
+      levels++;
+    } while(((fdims[0] - 1) >> levels) + 1 > LOD_THUMBNAIL || ((fdims[1] - 1) >> levels) + 1 > LOD_THUMBNAIL);
+  }
+
+  // the processes are arranged in a grid of blocks of 2^levels x 2^levels points, the last ones of each dimension
+  // holding the remaining points
+  int units[2] = {((fdims[0] - 1) >> levels) + 1, ((fdims[1] - 1) >> levels) + 1}, psize[2], pcoord[2];
+  splitProcesses(size, units, psize);
+  if(!psize[0]) {
+    fprintf(stderr, "Invalid number of processes for %d levels of a frame of %d x %d points.\n", levels, fdims[0], fdims[1]);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  pcoord[0] = rank / psize[1];
+  pcoord[1] = rank % psize[1];
+
+  // size and position of the block of the process at each level
+  int mdims[levels + 1][2], offset[levels + 1][2], ldims[levels + 1][2];
+  for(int d = 0; d < 2; d++) {
+    int count, start;
+    splitRange(units[d], psize[d], pcoord[d], &count, &start);
+    offset[0][d] = start << levels;
+    mdims[0][d] = (start + count) << levels < fdims[d] ? count << levels : fdims[d] - offset[0][d];
+    ldims[0][d] = fdims[d];
+    for(int l = 1; l <= levels; l++) {
+      mdims[l][d] = (mdims[l - 1][d] + 1) / 2;
+      offset[l][d] = offset[l - 1][d] / 2;
+      ldims[l][d] = (ldims[l - 1][d] + 1) / 2;
+    }
+  }
+
+  double *data[levels + 1];
+  for(int l = 0; l <= levels; l++) {
+    data[l] = (double*)malloc(mdims[l][0] * mdims[l][1] * sizeof(double));
+  }
+
+  writeIntAttribute(id_lod, "/", "levels", levels);
+
+  for(int i = first; i < argc; i++) {
+    int step = strtol(argv[i], NULL, 10);
+    if(errno == EINVAL || errno == ERANGE) {
+      MPI_Abort(MPI_COMM_WORLD, errno);
+    }
+
+    int group_id = createGroup(id_lod, "/%d", step);
+
+    readStep(id_heat, data[0], mdims[0], 0, fdims, offset[0][0], offset[0][1], 1, step);
+    for(int l = 1; l <= levels; l++) {
+      coarsenBlock(data[l - 1], mdims[l - 1][1], mdims[l - 1][0], mdims[l - 1][1], data[l], mdims[l][1]);
+      writeFrame(group_id, data[l], mdims[l], 0, ldims[l], offset[l][0], offset[l][1], 1, "./lod%d", l);
+    }
+
+    closeGroup(group_id);
+  }
+
+  closeFile(id_heat, 1);
+  closeFile(id_lod, 1);
+
+  for(int l = 0; l <= levels; l++) {
+    free(data[l]);
+  }
+
+  profileReport(MPI_COMM_WORLD);
+  MPI_Finalize();
+}
@@ -5,103 +5,288 @@
 
 #include <mpi.h>
 #include "hdf5IO.h"
+#include "decomp.h"
+#include "analysis.h"
+#include "profile.h"
 
-void Mean(double* data, int mdims[2], int fdims[2], int yOffset, double *xmean, double *ymean) {
-  for(int y = 0; y < mdims[0]; y++) {
-    for(int x = 0; x < mdims[1]; x++) {
-      xmean[y] += data[y*mdims[1] + x];
-      ymean[x + yOffset + 1] += data[y*mdims[1] + x];
-      ymean[0] += data[y*mdims[1] + x];
-    }
+// number of steps read and reduced together, when no --batch is given
+#define MEAN_BATCH 16
+
+
+// The means of the frames, computed on a grid of processes.
+// The sums of a row are only reduced between the processes holding this row, the sums of a column between the processes holding
+// this column, so that each process ends with a slice of x_mean and of y_mean that it writes itself.
+// The frames of a batch of steps are read and reduced together, in buffers allocated once.
+typedef struct {
+  int batch;
+  int fdims[2];
+  int psize[2];
+  int pcoord[2];
+  // size and position in the file of the block of the process
+  int mdims[2];
+  int offset[2];
+
+  // the processes holding the same rows, and the processes holding the same columns
+  MPI_Comm rowComm;
+  MPI_Comm colComm;
+
+  // the rows of x_mean and the columns of y_mean written by the process, in its block
+  int xCount, xStart;
+  int yCount, yStart;
+  // number of values of a step received by each process of colComm: its columns, and the total for the last one
+  int *yCounts;
+  int *recvCounts;
+
+  // [step][mdims[0] + 1] the sums of the rows of the block, followed by the sum of the block
+  double *rows;
+  // [step][mdims[1] + 1] the sums of the columns of the block, followed by the sum of the rows of the process
+  double *cols;
+  // cols ordered by destination process
+  double *packed;
+  // [step][yCounts[pcoord[0]]] the means of the columns of the process, followed by the mean of the frame on the last process
+  double *slice;
+  // the slices of x_mean, y_mean or mean of the batch, contiguous for writeMeanRows
+  double *out;
+} meanEngine;
+
+
+// Arrange the processes of comm in a grid over a frame of fdims points and allocate the buffers for batches of batch steps.
+void initMean(meanEngine *mean, int fdims[2], MPI_Comm comm, int batch) {
+  int size;
+  MPI_Comm_size(comm, &size);
+
+  mean->batch = batch;
+  mean->fdims[0] = fdims[0];
+  mean->fdims[1] = fdims[1];
+  splitProcesses(size, fdims, mean->psize);
+  if(!mean->psize[0]) {
+    fprintf(stderr, "Invalid number of processes for a frame of %d x %d points.\n", fdims[0], fdims[1]);
+    MPI_Abort(MPI_COMM_WORLD, 1);
   }
 
-  for(int i = 0; i < mdims[0]; i++) {
-    xmean[i] /= mdims[1];
+  MPI_Comm cartComm;
+  int periods[2] = {0, 0}, rank;
+  MPI_Cart_create(comm, 2, mean->psize, periods, 0, &cartComm);
+  MPI_Comm_rank(cartComm, &rank);
+  MPI_Cart_coords(cartComm, rank, 2, mean->pcoord);
+
+  // the remaining rows and columns are spread over the first processes of each dimension
+  for(int d = 0; d < 2; d++) {
+    splitRange(fdims[d], mean->psize[d], mean->pcoord[d], &mean->mdims[d], &mean->offset[d]);
   }
 
-  for(int i = 0; i < mdims[1]; i++) {
-    ymean[i + yOffset + 1] /= fdims[0];
+  int keepCols[2] = {0, 1}, keepRows[2] = {1, 0};
+  MPI_Cart_sub(cartComm, keepCols, &mean->rowComm);
+  MPI_Cart_sub(cartComm, keepRows, &mean->colComm);
+  MPI_Comm_free(&cartComm);
+
+  // the rows of the block are written by the processes of rowComm, its columns by the processes of colComm
+  splitRange(mean->mdims[0], mean->psize[1], mean->pcoord[1], &mean->xCount, &mean->xStart);
+  splitRange(mean->mdims[1], mean->psize[0], mean->pcoord[0], &mean->yCount, &mean->yStart);
+
+  mean->yCounts = (int*)malloc(mean->psize[0] * sizeof(int));
+  mean->recvCounts = (int*)malloc(mean->psize[0] * sizeof(int));
+  for(int r = 0; r < mean->psize[0]; r++) {
+    int start;
+    splitRange(mean->mdims[1], mean->psize[0], r, &mean->yCounts[r], &start);
   }
+  mean->yCounts[mean->psize[0] - 1]++;
+
+  mean->rows   = (double*)malloc(batch * (mean->mdims[0] + 1) * sizeof(double));
+  mean->cols   = (double*)malloc(batch * (mean->mdims[1] + 1) * sizeof(double));
+  mean->packed = (double*)malloc(batch * (mean->mdims[1] + 1) * sizeof(double));
+  mean->slice  = (double*)malloc(batch * mean->yCounts[mean->pcoord[0]] * sizeof(double));
+  mean->out    = (double*)malloc(batch * (mean->mdims[0] > mean->mdims[1] ? mean->mdims[0] : mean->mdims[1]) * sizeof(double));
+}
+
+
+void freeMean(meanEngine *mean) {
+  MPI_Comm_free(&mean->rowComm);
+  MPI_Comm_free(&mean->colComm);
+  free(mean->yCounts);
+  free(mean->recvCounts);
+  free(mean->rows);
+  free(mean->cols);
+  free(mean->packed);
+  free(mean->slice);
+  free(mean->out);
+}
+
 
-  ymean[0] /= (fdims[0] * fdims[1]);
+// Compute the sums of the block data of the step k of the batch.
+void sumMean(meanEngine *mean, double *data, int k) {
+  double *rows = &mean->rows[k * (mean->mdims[0] + 1)];
+  double *cols = &mean->cols[k * (mean->mdims[1] + 1)];
+  memset(rows, 0, (mean->mdims[0] + 1) * sizeof(double));
+  memset(cols, 0, (mean->mdims[1] + 1) * sizeof(double));
 
-  
+  sumBlock(data, mean->mdims[1], mean->mdims[0], mean->mdims[1], rows, cols, &rows[mean->mdims[0]]);
+}
+
+
+// Reduce the sums of the nb first steps of the batch and turn them into means.
+void Mean(meanEngine *mean, int nb) {
+  int rowSize = mean->mdims[0] + 1, colSize = mean->mdims[1] + 1;
+
+  // the sums of the rows, and of the blocks of the processes holding them
+  MPI_Allreduce(MPI_IN_PLACE, mean->rows, nb * rowSize, MPI_DOUBLE, MPI_SUM, mean->rowComm);
 
- 
-  double *ymean_cpy = (double*)calloc(fdims[1] + 1, sizeof(double));
+  // each process of colComm receives its columns of all the steps, the last one the sum of the whole frames
+  for(int k = 0; k < nb; k++) {
+    mean->cols[k * colSize + mean->mdims[1]] = mean->rows[k * rowSize + mean->mdims[0]];
+  }
+  double *packed = mean->packed;
+  for(int r = 0, start = 0; r < mean->psize[0]; start += mean->yCounts[r], r++) {
+    for(int k = 0; k < nb; k++) {
+      memcpy(packed, &mean->cols[k * colSize + start], mean->yCounts[r] * sizeof(double));
+      packed += mean->yCounts[r];
+    }
+    mean->recvCounts[r] = nb * mean->yCounts[r];
+  }
+  MPI_Reduce_scatter(mean->packed, mean->slice, mean->recvCounts, MPI_DOUBLE, MPI_SUM, mean->colComm);
 
-  MPI_Reduce(ymean, ymean_cpy, fdims[1] + 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-  memcpy(ymean, ymean_cpy, (fdims[1] + 1) * sizeof(double));
-  free(ymean_cpy);
+  int sliceSize = mean->yCounts[mean->pcoord[0]];
+  for(int k = 0; k < nb; k++) {
+    double *rows = &mean->rows[k * rowSize], *slice = &mean->slice[k * sliceSize];
+    for(int i = 0; i < mean->xCount; i++) {
+      rows[mean->xStart + i] /= mean->fdims[1];
+    }
+    for(int i = 0; i < mean->yCount; i++) {
+      slice[i] /= mean->fdims[0];
+    }
+    if(sliceSize > mean->yCount) {
+      slice[mean->yCount] /= (double)mean->fdims[0] * mean->fdims[1];
+    }
+  }
+}
+
+
+// Write the means of the step k of the batch in the group id.
+void writeMean(meanEngine *mean, int id, int k) {
+  int sliceSize = mean->yCounts[mean->pcoord[0]];
+  double *rows = &mean->rows[k * (mean->mdims[0] + 1)], *slice = &mean->slice[k * sliceSize];
+
+  // one of the processes holding the total writes the mean, the others take part in the collective write with an empty array
+  int meanSize[2]  = {sliceSize > mean->yCount && mean->pcoord[1] == 0, 1};
+  int meanFileSize[2] = {1, 1};
+  int xmeanSize[2] = {mean->xCount, 1};
+  int xmeanFileSize[2] = {mean->fdims[0], 1};
+  int ymeanSize[2] = {mean->yCount, 1};
+  int ymeanFileSize[2] = {mean->fdims[1], 1};
+
+  writeFrame(id, &slice[mean->yCount], meanSize, 0, meanFileSize, 0, 0, 1, "./mean");
+  writeFrame(id, &rows[mean->xStart], xmeanSize, 0, xmeanFileSize, mean->offset[0] + mean->xStart, 0, 1, "./x_mean");
+  writeFrame(id, slice, ymeanSize, 0, ymeanFileSize, mean->offset[1] + mean->yStart, 0, 1, "./y_mean");
+}
+
+
+// Write the means of the nb first steps of the batch in the rows first to first + nb - 1 of the datasets /mean, /x_mean and
+// /y_mean of the file id, of nbSteps rows each, with one collective write per dataset.
+void writeMeanRows(meanEngine *mean, int id, int first, int nb, int nbSteps) {
+  int sliceSize = mean->yCounts[mean->pcoord[0]];
+  int writer = sliceSize > mean->yCount && mean->pcoord[1] == 0;
+
+  int meanSize[2]  = {writer ? nb : 0, 1};
+  int meanFileSize[2] = {nbSteps, 1};
+  int xmeanSize[2] = {nb, mean->xCount};
+  int xmeanFileSize[2] = {nbSteps, mean->fdims[0]};
+  int ymeanSize[2] = {nb, mean->yCount};
+  int ymeanFileSize[2] = {nbSteps, mean->fdims[1]};
+
+  for(int k = 0; k < nb; k++) {
+    mean->out[k] = mean->slice[k * sliceSize + mean->yCount];
+  }
+  writeFrame(id, mean->out, meanSize, 0, meanFileSize, first, 0, 1, "/mean");
+
+  for(int k = 0; k < nb; k++) {
+    memcpy(&mean->out[k * mean->xCount], &mean->rows[k * (mean->mdims[0] + 1) + mean->xStart], mean->xCount * sizeof(double));
+  }
+  writeFrame(id, mean->out, xmeanSize, 0, xmeanFileSize, first, mean->offset[0] + mean->xStart, 1, "/x_mean");
+
+  for(int k = 0; k < nb; k++) {
+    memcpy(&mean->out[k * mean->yCount], &mean->slice[k * sliceSize], mean->yCount * sizeof(double));
+  }
+  writeFrame(id, mean->out, ymeanSize, 0, ymeanFileSize, first, mean->offset[1] + mean->yStart, 1, "/y_mean");
 }
 
 int main(int argc, char** argv) {
-  MPI_Init(&argc, &argv);
+  // the OpenMP threads only compute, all communications go through the main thread
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  profileInit();
 
 
   int size, rank;
   MPI_Comm_size(MPI_COMM_WORLD, &size);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  printf("%d %d\n\n", rank, size);
- 
+
   // open heat.h5, diags.h5
   int id_heat = openFile(1, "heat.h5"),
       id_mean = createFile(1, "diags.h5");
 
   int fdims[2];
   getDims(id_heat, fdims);
-  
-  int mdims[2];
-  mdims[1] = fdims[1];
-  if(fdims[0] % size) {
-    MPI_Abort(MPI_COMM_WORLD, 1);
-  }
-  mdims[0] = fdims[0] / size;
-
-
-
-  double* data  = (double*)malloc(mdims[0] * mdims[1] * sizeof(double));
-  double *xmean = (double*)calloc(mdims[0], sizeof(double));
-  double *ymean = (double*)calloc(fdims[1] + 1, sizeof(double));
-
-  int meanSize[2]  = {1, 1};
-  int xmeanSize[2] = {mdims[0], 1};
-  int ymeanSize[2] = {fdims[1], 1};
-
-  //printf("%d %d\n", fdims[0], fdims[1]);
-
-  
 
+  // with --batch K, the means are written as rows of /mean, /x_mean and /y_mean, K steps at a time
+  int batch = MEAN_BATCH, rows = argc > 2 && !strcmp(argv[1], "--batch");
+  if(rows) {
+    batch = strtol(argv[2], NULL, 10);
+    if(batch < 1) {
+      fprintf(stderr, "Invalid batch size %s.\n", argv[2]);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
 
+  // each process reads a block of the frames, arranged as the blocks of heat.out
+  meanEngine mean;
+  initMean(&mean, fdims, MPI_COMM_WORLD, batch);
 
+  double* data  = (double*)malloc(batch * mean.mdims[0] * mean.mdims[1] * sizeof(double));
 
-  for(int i = 1; i < argc; i++) {
-    int step = strtol(argv[i], NULL, 10);
+  int nbSteps = 0, *steps = (int*)malloc(argc * sizeof(int));
+  for(int i = rows ? 3 : 1; i < argc; i++) {
+    steps[nbSteps++] = strtol(argv[i], NULL, 10);
     if(errno == EINVAL || errno == ERANGE) {
       MPI_Abort(MPI_COMM_WORLD, errno);
     }
-    
-    int group_id = createGroup(id_mean, "/%d", step);
+  }
 
-    readFrame(id_heat, data, mdims, 0, fdims, mdims[0] * rank, 0, 1, "/step%d", step);
+  if(rows) {
+    writeIntArray(id_mean, steps, nbSteps, 1, "/steps");
+  }
 
-    Mean(data, mdims, fdims, mdims[0] * rank, xmean, ymean);
 
-    if(rank == 0) {
-      writeFrame(group_id, ymean, meanSize, 0, meanSize, 0, 0, 0,"./mean");
-    }
 
+  for(int first = 0; first < nbSteps; first += batch) {
+    int nb = nbSteps - first < batch ? nbSteps - first : batch;
 
-    writeFrame(group_id, xmean, xmeanSize, 0, xmeanSize, 0, 0, 1,"./x_mean");
-    writeFrame(group_id, &ymean[1], ymeanSize, 0, ymeanSize, 0, 0, 1,"./y_mean");
+    // the frames of a time series are read at once
+    readSteps(id_heat, data, mean.mdims, 0, fdims, mean.offset[0], mean.offset[1], 1, nb, &steps[first]);
+    for(int k = 0; k < nb; k++) {
+      sumMean(&mean, &data[k * mean.mdims[0] * mean.mdims[1]], k);
+    }
 
+    Mean(&mean, nb);
 
-    closeGroup(group_id);
+    if(rows) {
+      writeMeanRows(&mean, id_mean, first, nb, nbSteps);
+    } else {
+      for(int k = 0; k < nb; k++) {
+        int group_id = createGroup(id_mean, "/%d", steps[first + k]);
+        writeMean(&mean, group_id, k);
+        closeGroup(group_id);
+      }
+    }
   }
 
+  free(steps);
+  free(data);
+  freeMean(&mean);
+
   closeFile(id_heat, 1);
   closeFile(id_mean, 1);
 
 
+  profileReport(MPI_COMM_WORLD);
   MPI_Finalize();
 }
@@ -0,0 +1,107 @@
+#include <mpi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+int profiling = 0;
+
+// the time spent in each phase, the number of times it was run and the bytes it moved
+static struct {
+  const char *file;
+  double begin;
+  double start[PROFILE_PHASES];
+  double time[PROFILE_PHASES];
+  long long calls[PROFILE_PHASES];
+  long long bytes[PROFILE_PHASES];
+} profile;
+
+static const char *phaseNames[PROFILE_PHASES] = {"iter", "exchange", "write", "read", "analysis"};
+
+
+// Start profiling if the environment variable HEAT_PROFILE names the file of the report, written by profileReport
+// in CSV if its name ends with .csv, in JSON otherwise.
+void profileInit(void) {
+  const char *file = getenv("HEAT_PROFILE");
+  if(file && *file) {
+    profile.file = file;
+    profile.begin = MPI_Wtime();
+    profiling = 1;
+  }
+}
+
+
+// Start timing a phase. A phase is timed by one thread at a time, and is not nested in itself.
+void profileStart(int phase) {
+  profile.start[phase] = MPI_Wtime();
+}
+
+
+// Stop timing a phase, which moved bytes bytes (0 when it is not counted).
+void profileStop(int phase, long long bytes) {
+  profile.time[phase] += MPI_Wtime() - profile.start[phase];
+  profile.calls[phase]++;
+  profile.bytes[phase] += bytes;
+}
+
+
+// Reduce the times over the processes of comm, and write the report on the first process:
+// for each phase, the minimum, average and maximum time of the processes, the imbalance (maximum / average),
+// and the total number of calls and bytes.
+void profileReport(MPI_Comm comm) {
+  if(!profiling) {
+    return;
+  }
+
+  // the last entry is the whole run
+  double time[PROFILE_PHASES + 1], minTime[PROFILE_PHASES + 1], maxTime[PROFILE_PHASES + 1], sumTime[PROFILE_PHASES + 1];
+  long long counts[2 * PROFILE_PHASES], sumCounts[2 * PROFILE_PHASES];
+  memcpy(time, profile.time, sizeof(profile.time));
+  time[PROFILE_PHASES] = MPI_Wtime() - profile.begin;
+  memcpy(counts, profile.calls, sizeof(profile.calls));
+  memcpy(&counts[PROFILE_PHASES], profile.bytes, sizeof(profile.bytes));
+
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  MPI_Reduce(time, minTime, PROFILE_PHASES + 1, MPI_DOUBLE, MPI_MIN, 0, comm);
+  MPI_Reduce(time, maxTime, PROFILE_PHASES + 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(time, sumTime, PROFILE_PHASES + 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(counts, sumCounts, 2 * PROFILE_PHASES, MPI_LONG_LONG, MPI_SUM, 0, comm);
+  if(rank != 0) {
+    return;
+  }
+
+  FILE *f = fopen(profile.file, "w");
+  if(!f) {
+    fprintf(stderr, "Unable to write the profile in %s.\n", profile.file);
+    return;
+  }
+
+  size_t length = strlen(profile.file);
+  int csv = length >= 4 && !strcmp(profile.file + length - 4, ".csv");
+  if(csv) {
+    fprintf(f, "phase,min,avg,max,imbalance,calls,bytes\n");
+  } else {
+    fprintf(f, "{\n  \"processes\": %d,\n  \"phases\": {\n", size);
+  }
+  for(int p = 0; p <= PROFILE_PHASES; p++) {
+    const char *name = p < PROFILE_PHASES ? phaseNames[p] : "total";
+    double avg = sumTime[p] / size;
+    double imbalance = avg > 0 ? maxTime[p] / avg : 1;
+    long long calls = p < PROFILE_PHASES ? sumCounts[p] : 0;
+    long long bytes = p < PROFILE_PHASES ? sumCounts[PROFILE_PHASES + p] : 0;
+    if(csv) {
+      fprintf(f, "%s,%.6f,%.6f,%.6f,%.3f,%lld,%lld\n", name, minTime[p], avg, maxTime[p], imbalance, calls, bytes);
+    } else {
+      fprintf(f, "    \"%s\": {\"min\": %.6f, \"avg\": %.6f, \"max\": %.6f, \"imbalance\": %.3f, \"calls\": %lld, \"bytes\": %lld}%s\n",
+              name, minTime[p], avg, maxTime[p], imbalance, calls, bytes, p < PROFILE_PHASES ? "," : "");
+    }
+  }
+  if(!csv) {
+    fprintf(f, "  }\n}\n");
+  }
+  fclose(f);
+}
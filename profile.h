@@ -0,0 +1,31 @@
+#ifndef __PROFILE__
+#define __PROFILE__
+
+#include <mpi.h>
+
+// the phases timed, see profileStart
+enum {
+  PROFILE_ITER,
+  PROFILE_EXCHANGE,
+  PROFILE_WRITE,
+  PROFILE_READ,
+  PROFILE_ANALYSIS,
+  PROFILE_PHASES
+};
+
+// set by profileInit when a report is asked for
+extern int profiling;
+
+// time a phase, the macros cost a test when profiling is off and do not evaluate bytes
+#define PROFILE_START(phase) do { if(profiling) profileStart(phase); } while(0)
+#define PROFILE_STOP(phase, bytes) do { if(profiling) profileStop(phase, bytes); } while(0)
+
+void profileInit(void);
+
+void profileStart(int phase);
+
+void profileStop(int phase, long long bytes);
+
+void profileReport(MPI_Comm comm);
+
+#endif
@@ -0,0 +1,287 @@
+#include <mpi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "stencil.h"
+
+// size of the tiles: a tile row and its two neighbours stay in L1, the tile in L2
+static int tileHeight = 64;
+static int tileWidth  = 512;
+
+
+// Change the size of the tiles used by stencilTiled, stencilTiledSingle and stencilTemporal
+void setStencilTile(int height, int width) {
+  tileHeight = height;
+  tileWidth  = width;
+}
+
+// weights of the point itself and of its 4 neighbours, those of iter() by default
+static double centerWeight = .5;
+static double sideWeight   = .125;
+
+
+// Change the weights of the stencil, the kernels specialized for the default weights are no longer used
+void setStencilWeights(double center, double side) {
+  centerWeight = center;
+  sideWeight   = side;
+}
+
+
+// Compute n points of a row of the 5 points stencil from the rows above (up), on (mid) and below (down) it.
+// The terms are added in the same order as in iter() so that the results are identical.
+static void stencilRow(const double *restrict up, const double *restrict mid, const double *restrict down, double *restrict out, int n) {
+  int x = 0;
+
+#if defined(__AVX512F__)
+  const __m512d half8 = _mm512_set1_pd(.5), eighth8 = _mm512_set1_pd(.125);
+  for(; x + 8 <= n; x += 8) {
+    __m512d v = _mm512_mul_pd(_mm512_loadu_pd(mid + x), half8);
+    v = _mm512_add_pd(v, _mm512_mul_pd(_mm512_loadu_pd(mid + x - 1), eighth8));
+    v = _mm512_add_pd(v, _mm512_mul_pd(_mm512_loadu_pd(mid + x + 1), eighth8));
+    v = _mm512_add_pd(v, _mm512_mul_pd(_mm512_loadu_pd(up + x), eighth8));
+    v = _mm512_add_pd(v, _mm512_mul_pd(_mm512_loadu_pd(down + x), eighth8));
+    _mm512_storeu_pd(out + x, v);
+  }
+#endif
+
+#if defined(__AVX2__)
+  const __m256d half4 = _mm256_set1_pd(.5), eighth4 = _mm256_set1_pd(.125);
+  for(; x + 4 <= n; x += 4) {
+    __m256d v = _mm256_mul_pd(_mm256_loadu_pd(mid + x), half4);
+    v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_loadu_pd(mid + x - 1), eighth4));
+    v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_loadu_pd(mid + x + 1), eighth4));
+    v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_loadu_pd(up + x), eighth4));
+    v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_loadu_pd(down + x), eighth4));
+    _mm256_storeu_pd(out + x, v);
+  }
+#endif
+
+  for(; x < n; x++) {
+    out[x] = (mid[x] * .5)
+      + (mid[x-1] * .125)
+      + (mid[x+1] * .125)
+      + (up[x]    * .125)
+      + (down[x]  * .125);
+  }
+}
+
+
+// Same as stencilRow with the weights set by setStencilWeights
+static void stencilRowWeights(const double *restrict up, const double *restrict mid, const double *restrict down, double *restrict out, int n) {
+  const double center = centerWeight, side = sideWeight;
+  #pragma omp simd
+  for(int x = 0; x < n; x++) {
+    out[x] = (mid[x] * center)
+      + (mid[x-1] * side)
+      + (mid[x+1] * side)
+      + (up[x]    * side)
+      + (down[x]  * side);
+  }
+}
+
+
+// Define stencilRow<W>, the row of the default weights for a width of W points known at compile time:
+// the loop has no remainder and the compiler vectorizes and unrolls it for the target.
+#define STENCIL_ROW_FIXED(W) \
+  static void stencilRow##W(const double *restrict up, const double *restrict mid, const double *restrict down, double *restrict out, int n) { \
+    (void)n; \
+    _Pragma("omp simd") \
+    for(int x = 0; x < W; x++) { \
+      out[x] = (mid[x] * .5) \
+        + (mid[x-1] * .125) \
+        + (mid[x+1] * .125) \
+        + (up[x]    * .125) \
+        + (down[x]  * .125); \
+    } \
+  }
+
+STENCIL_ROW_FIXED(64)
+STENCIL_ROW_FIXED(128)
+STENCIL_ROW_FIXED(256)
+STENCIL_ROW_FIXED(512)
+
+
+typedef void (*rowKernel)(const double *restrict up, const double *restrict mid, const double *restrict down, double *restrict out, int n);
+
+// the specialized rows, by width: the widths of the default tiles and of the usual blocks
+static const struct {
+  int width;
+  rowKernel row;
+} fixedRows[] = {
+  {64,  stencilRow64},
+  {128, stencilRow128},
+  {256, stencilRow256},
+  {512, stencilRow512},
+};
+
+
+// Choose the row kernel for rows of n points and the current weights
+static rowKernel selectRow(int n) {
+  if(centerWeight != .5 || sideWeight != .125) {
+    return stencilRowWeights;
+  }
+  for(int i = 0; i < (int)(sizeof(fixedRows) / sizeof(fixedRows[0])); i++) {
+    if(fixedRows[i].width == n) {
+      return fixedRows[i].row;
+    }
+  }
+  return stencilRow;
+}
+
+
+// Compute the 5 points stencil of cur in next on the rows [ymin, ymax[ and the columns [xmin, xmax[
+// of a block of width columns stored row by row.
+void stencilRect(int width, const double *cur, double *next, int ymin, int ymax, int xmin, int xmax) {
+  if(xmax <= xmin) return;
+
+  rowKernel row = selectRow(xmax - xmin);
+  for(int y = ymin; y < ymax; y++) {
+    const double *mid = cur + (size_t)y * width + xmin;
+    row(mid - width, mid, mid + width, next + (size_t)y * width + xmin, xmax - xmin);
+  }
+}
+
+
+// Single precision version of stencilRect, twice as many points fit in a vector
+void stencilRectSingle(int width, const float *cur, float *next, int ymin, int ymax, int xmin, int xmax) {
+  for(int y = ymin; y < ymax; y++) {
+    const float *restrict mid = cur + (size_t)y * width;
+    const float *restrict up = mid - width, *restrict down = mid + width;
+    float *restrict out = next + (size_t)y * width;
+    #pragma omp simd
+    for(int x = xmin; x < xmax; x++) {
+      out[x] = (mid[x] * .5f)
+        + (mid[x-1] * .125f)
+        + (mid[x+1] * .125f)
+        + (up[x]    * .125f)
+        + (down[x]  * .125f);
+    }
+  }
+}
+
+
+// Same as stencilRect, but by tiles small enough for the three rows used by each row of a tile to stay in cache
+void stencilTiled(int width, const double *cur, double *next, int ymin, int ymax, int xmin, int xmax) {
+  // the tiles are shared between the threads of the process
+  #pragma omp parallel for collapse(2) schedule(static)
+  for(int ty = ymin; ty < ymax; ty += tileHeight) {
+    for(int tx = xmin; tx < xmax; tx += tileWidth) {
+      int tymax = ty + tileHeight < ymax ? ty + tileHeight : ymax;
+      int txmax = tx + tileWidth < xmax ? tx + tileWidth : xmax;
+      stencilRect(width, cur, next, ty, tymax, tx, txmax);
+    }
+  }
+}
+
+
+// Advance nsteps time steps at once, tile by tile, with the 5 points stencil on a height x width block stored row by row.
+// The points [lo[0], hi[0][ x [lo[1], hi[1][ of next receive the values at t + nsteps computed from cur at t.
+// fixed tells for each side (top, bottom, left, right) whether the points beyond the rectangle are boundary values
+// that stay constant. On the other sides cur must hold valid values on nsteps points beyond the rectangle (ghost zones
+// of nsteps points); each tile then recomputes the part of its neighbourhood it needs, so the tiles are independent.
+void stencilTemporal(int height, int width, const double *cur, double *next, int lo[2], int hi[2], int fixed[4], int nsteps) {
+  // the region read by the first step of the tiles on the sides of the rectangle must be in the block
+  if(lo[0] - (fixed[0] ? 1 : nsteps) < 0 || hi[0] + (fixed[1] ? 1 : nsteps) > height ||
+     lo[1] - (fixed[2] ? 1 : nsteps) < 0 || hi[1] + (fixed[3] ? 1 : nsteps) > width) {
+    fprintf(stderr, "The ghost zones are too small for %d steps of temporal blocking.\n", nsteps);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  // the largest region recomputed for a tile, plus the points it reads
+  int sheight = tileHeight + 2 * nsteps, swidth = tileWidth + 2 * nsteps;
+
+  // the tiles are shared between the threads of the process, each one with its own scratch buffers;
+  // the threads skip the tiles together when one of them has no buffer, the error is reported after the region
+  int noMemory = 0;
+  #pragma omp parallel
+  {
+    double *scratch[2];
+    scratch[0] = (double*)malloc(2 * (size_t)sheight * swidth * sizeof(double));
+    scratch[1] = scratch[0] + (size_t)sheight * swidth;
+    if(!scratch[0]) {
+      #pragma omp atomic write
+      noMemory = 1;
+    }
+    #pragma omp barrier
+
+    int skip;
+    #pragma omp atomic read
+    skip = noMemory;
+
+    #pragma omp for collapse(2) schedule(static)
+    for(int ty = lo[0]; ty < hi[0]; ty += tileHeight) {
+      for(int tx = lo[1]; tx < hi[1]; tx += tileWidth) {
+        if(skip) continue;
+        int tymax = ty + tileHeight < hi[0] ? ty + tileHeight : hi[0];
+        int txmax = tx + tileWidth < hi[1] ? tx + tileWidth : hi[1];
+
+        // how far the tile grows on each side at the first step: not past the boundary values, which may be
+        // closer than nsteps points when nsteps exceeds the tiles
+        int grow[4] = {
+          fixed[0] && ty - lo[0] < nsteps - 1 ? ty - lo[0] : nsteps - 1,
+          fixed[1] && hi[0] - tymax < nsteps - 1 ? hi[0] - tymax : nsteps - 1,
+          fixed[2] && tx - lo[1] < nsteps - 1 ? tx - lo[1] : nsteps - 1,
+          fixed[3] && hi[1] - txmax < nsteps - 1 ? hi[1] - txmax : nsteps - 1
+        };
+        // the sides that reach the boundary values keep their points valid at every step
+        int reach[4] = {
+          fixed[0] && ty - grow[0] == lo[0],
+          fixed[1] && tymax + grow[1] == hi[0],
+          fixed[2] && tx - grow[2] == lo[1],
+          fixed[3] && txmax + grow[3] == hi[1]
+        };
+
+        // copy the region read by the first step in both scratch buffers, the boundary values stay in both
+        int sy = ty - grow[0] - 1, sx = tx - grow[2] - 1;
+        int sh = tymax + grow[1] + 1 - sy, sw = txmax + grow[3] + 1 - sx;
+        for(int y = 0; y < sh; y++) {
+          memcpy(scratch[0] + (size_t)y * sw, cur + (size_t)(sy + y) * width + sx, sw * sizeof(double));
+        }
+        memcpy(scratch[1], scratch[0], (size_t)sh * sw * sizeof(double));
+
+        // each step computes a region one point smaller on the other sides
+        for(int s = 0; s < nsteps; s++) {
+          int shrink[4];
+          for(int side = 0; side < 4; side++) {
+            shrink[side] = reach[side] ? 0 : s;
+          }
+          stencilRect(sw, scratch[s % 2], scratch[(s + 1) % 2],
+              1 + shrink[0], sh - 1 - shrink[1],
+              1 + shrink[2], sw - 1 - shrink[3]);
+        }
+
+        // the tile itself holds the values at t + nsteps
+        const double *result = scratch[nsteps % 2];
+        for(int y = ty; y < tymax; y++) {
+          memcpy(next + (size_t)y * width + tx, result + (size_t)(y - sy) * sw + (tx - sx), (txmax - tx) * sizeof(double));
+        }
+      }
+    }
+
+    free(scratch[0]);
+  }
+
+  if(noMemory) {
+    fprintf(stderr, "Not enough memory for the temporal blocking.\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+
+// Single precision version of stencilTiled, with the same tiles
+void stencilTiledSingle(int width, const float *cur, float *next, int ymin, int ymax, int xmin, int xmax) {
+  #pragma omp parallel for collapse(2) schedule(static)
+  for(int ty = ymin; ty < ymax; ty += tileHeight) {
+    for(int tx = xmin; tx < xmax; tx += tileWidth) {
+      int tymax = ty + tileHeight < ymax ? ty + tileHeight : ymax;
+      int txmax = tx + tileWidth < xmax ? tx + tileWidth : xmax;
+      stencilRectSingle(width, cur, next, ty, tymax, tx, txmax);
+    }
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef __STENCIL__
+#define __STENCIL__
+
+void setStencilTile(int height, int width);
+
+void setStencilWeights(double center, double side);
+
+void stencilRect(int width, const double *cur, double *next, int ymin, int ymax, int xmin, int xmax);
+
+void stencilTiled(int width, const double *cur, double *next, int ymin, int ymax, int xmin, int xmax);
+
+void stencilRectSingle(int width, const float *cur, float *next, int ymin, int ymax, int xmin, int xmax);
+
+void stencilTiledSingle(int width, const float *cur, float *next, int ymin, int ymax, int xmin, int xmax);
+
+void stencilTemporal(int height, int width, const double *cur, double *next, int lo[2], int hi[2], int fixed[4], int nsteps);
+
+#endif
@@ -0,0 +1,112 @@
+#include <mpi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "transit.h"
+
+// tag of the frames, they are received in the order they are sent
+#define FRAME_TAG 300
+
+// the ring of send buffers of a process streaming its frames to another one
+static struct {
+  MPI_Comm comm;
+  int dest;
+
+  // the frames are the arrays of arrayDims points without their margin
+  int arrayDims[2];
+  int dataMargin;
+  int frameSize;
+
+  // a buffer is free when its send request is completed, that is when the receiver has taken the frame; they are used in turn
+  double **buffers;
+  MPI_Request *reqs;
+  int depth;
+  int next;
+
+  int dropped;
+} sender;
+
+
+// start streaming to the process dest of comm the arrays of arrayDims points, without their margin of dataMargin points,
+// through depth send buffers.
+void startSender(MPI_Comm comm, int dest, int depth, int *arrayDims, int dataMargin) {
+  sender.comm = comm;
+  sender.dest = dest;
+  sender.arrayDims[0] = arrayDims[0];
+  sender.arrayDims[1] = arrayDims[1];
+  sender.dataMargin = dataMargin;
+  sender.frameSize = (arrayDims[0] - 2 * dataMargin) * (arrayDims[1] - 2 * dataMargin);
+  sender.depth = depth;
+  sender.next = 0;
+  sender.dropped = 0;
+
+  sender.buffers = (double**)malloc(depth * sizeof(double*));
+  sender.reqs = (MPI_Request*)malloc(depth * sizeof(MPI_Request));
+  for(int i = 0; i < depth; i++) {
+    sender.buffers[i] = (double*)malloc(sender.frameSize * sizeof(double));
+    sender.reqs[i] = MPI_REQUEST_NULL;
+  }
+}
+
+
+// copy the frame and start sending it, without waiting for the receiver.
+// If the receiver still has not taken the oldest frame in flight, the frame is dropped and an empty message takes its place.
+// Return 1 if the frame is sent, 0 if it is dropped.
+int sendFrame(double *data) {
+  int done;
+  MPI_Test(&sender.reqs[sender.next], &done, MPI_STATUS_IGNORE);
+  if(!done) {
+    // the empty messages need no buffer, the receiver learns that the frame is missing in the same order
+    MPI_Request req;
+    MPI_Isend(NULL, 0, MPI_DOUBLE, sender.dest, FRAME_TAG, sender.comm, &req);
+    MPI_Request_free(&req);
+    sender.dropped++;
+    return 0;
+  }
+
+  // copy the points inside the margin
+  double *buffer = sender.buffers[sender.next];
+  int rows = sender.arrayDims[0] - 2 * sender.dataMargin, cols = sender.arrayDims[1] - 2 * sender.dataMargin;
+  for(int y = 0; y < rows; y++) {
+    for(int x = 0; x < cols; x++) {
+      buffer[y*cols + x] = data[(y + sender.dataMargin)*sender.arrayDims[1] + x + sender.dataMargin];
+    }
+  }
+
+  // a synchronous send only completes once the receiver takes the frame, a standard one may complete as soon as it is
+  // buffered by MPI (small frames, shared memory), which would never let the receiver slow the sender down
+  MPI_Issend(buffer, sender.frameSize, MPI_DOUBLE, sender.dest, FRAME_TAG, sender.comm, &sender.reqs[sender.next]);
+  sender.next = (sender.next + 1) % sender.depth;
+  return 1;
+}
+
+
+// wait for the frames in flight and free the send buffers.
+// Return the number of frames dropped.
+int stopSender(void) {
+  MPI_Waitall(sender.depth, sender.reqs, MPI_STATUSES_IGNORE);
+  for(int i = 0; i < sender.depth; i++) {
+    free(sender.buffers[i]);
+  }
+  free(sender.buffers);
+  free(sender.reqs);
+
+  return sender.dropped;
+}
+
+
+// receive in data the next frame of frameSize points sent by the process source of comm with sendFrame.
+// Return 1 if the frame is received, 0 if the sender dropped it.
+int recvFrame(MPI_Comm comm, int source, double *data, int frameSize) {
+  MPI_Status status;
+  MPI_Recv(data, frameSize, MPI_DOUBLE, source, FRAME_TAG, comm, &status);
+
+  int count;
+  MPI_Get_count(&status, MPI_DOUBLE, &count);
+  if(count != 0 && count != frameSize) {
+    fprintf(stderr, "Received a frame of %d points instead of %d.\n", count, frameSize);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  return count != 0;
+}
@@ -0,0 +1,14 @@
+#ifndef __TRANSIT__
+#define __TRANSIT__
+
+#include <mpi.h>
+
+void startSender(MPI_Comm comm, int dest, int depth, int *arrayDims, int dataMargin);
+
+int sendFrame(double *data);
+
+int stopSender(void);
+
+int recvFrame(MPI_Comm comm, int source, double *data, int frameSize);
+
+#endif